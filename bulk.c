@@ -0,0 +1,231 @@
+/* Bottom-up reverse trie construction from sorted names. */
+#include "bulk.h"
+#include "keys.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct bulk_key {
+    const char *key;
+    uint32_t strlen;
+    int32_t ip4_address;
+};
+
+// char depth from the end of a key, shifted up by one so that a key
+//  that has run out sorts first, as 0.
+static inline int char_at(const struct bulk_key *k, uint32_t depth)
+{
+    return depth < k->strlen ? 1 + (unsigned char)k->key[k->strlen - 1 - depth] : 0;
+}
+
+// keys that already agree on their last depth chars, compared from
+//  there backwards.  a key sorts before every longer key ending with it.
+static int compare_reversed(const struct bulk_key *k1, const struct bulk_key *k2,
+                            uint32_t depth)
+{
+    int cmp;
+
+    key_suffix(k1->key, k1->strlen - depth, k2->key, k2->strlen - depth, &cmp);
+    if (cmp)
+        return cmp;
+    return (k1->strlen > k2->strlen) - (k1->strlen < k2->strlen);
+}
+
+// stable MSD radix sort on reversed keys: bucket by the char at depth,
+//  then sort each bucket on the next one.  keys that run out together
+//  are equal and stay in input order, so the first of a run of
+//  duplicates is the one that was given first.  small buckets go to
+//  an insertion sort, which is stable as well.
+static void sort_reversed(struct bulk_key *keys, struct bulk_key *scratch,
+                          size_t n, uint32_t depth)
+{
+    size_t count[257], start[257], i, j;
+    int c, largest;
+
+    while (n >= 32)
+    {
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; ++i)
+            count[char_at(&keys[i], depth)]++;
+        for (c = 0, j = 0; c < 257; ++c)
+        {
+            start[c] = j;
+            j += count[c];
+        }
+        for (i = 0; i < n; ++i)
+            scratch[start[char_at(&keys[i], depth)]++] = keys[i];
+        memcpy(keys, scratch, n * sizeof(*keys));
+
+        // recurse on all but the largest bucket and loop on that one,
+        //  so the recursion stays shallow.  bucket 0 is already done.
+        largest = 1;
+        for (c = 2; c < 257; ++c)
+            if (count[c] > count[largest])
+                largest = c;
+        for (c = 1; c < 257; ++c)
+            if (c != largest && count[c] > 1)
+                sort_reversed(keys + start[c] - count[c], scratch,
+                              count[c], depth + 1);
+        keys += start[largest] - count[largest];
+        n = count[largest];
+        ++depth;
+    }
+
+    for (i = 1; i < n; ++i)
+    {
+        struct bulk_key k = keys[i];
+        for (j = i; j > 0 && compare_reversed(&keys[j - 1], &k, depth) > 0; --j)
+            keys[j] = keys[j - 1];
+        keys[j] = k;
+    }
+}
+
+int bulk_plan_build(struct bulk_plan *plan, const char **keys,
+                    const size_t *lens, const int32_t *ips, size_t n)
+{
+    // the path from the root to the last name added: each entry is a
+    //  node and the depth (in chars from the end of the name) that it
+    //  reaches.  depths strictly increase, so it never outgrows the
+    //  longest name.  entry 0 stands for the root list itself.
+    struct {
+        int64_t node;
+        uint32_t depth;
+    } stack[BULK_MAX_KEY + 2];
+    struct bulk_key *sorted;
+    int64_t *tail, root_tail = -1;
+    size_t i, m = 0;
+    int sp;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->root = -1;
+    sorted = malloc(2 * n * sizeof(*sorted) + 1);     /* + radix scratch */
+    plan->nodes = malloc(2 * n * sizeof(*plan->nodes) + 1);
+    tail = malloc(2 * n * sizeof(*tail) + 1);
+    if (!sorted || !plan->nodes || !tail)
+    {
+        perror("Failed to allocate memory for bulk_plan_build().\n");
+        free(sorted);
+        free(tail);
+        bulk_plan_free(plan);
+        return 0;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        if (lens[i] == 0 || lens[i] > BULK_MAX_KEY || ips[i] == 0 ||
+            !key_encodable(keys[i], lens[i]))
+        {
+            plan->skipped++;
+            continue;
+        }
+        sorted[m].key = keys[i];
+        sorted[m].strlen = (uint32_t)lens[i];
+        sorted[m].ip4_address = ips[i];
+        ++m;
+    }
+    sort_reversed(sorted, sorted + n, m, 0);
+
+    stack[0].node = -1;
+    stack[0].depth = 0;
+    sp = 1;
+    for (i = 0; i < m; ++i)
+    {
+        struct bulk_key *k = &sorted[i];
+        struct bulk_node *leaf;
+        int64_t last = -1, parent, z;
+        uint32_t last_depth = 0, lcp = 0;
+
+        if (i > 0)
+        {
+            lcp = key_suffix(sorted[i - 1].key, sorted[i - 1].strlen,
+                             k->key, k->strlen, NULL);
+            if (lcp == k->strlen && lcp == sorted[i - 1].strlen)
+            {
+                plan->duplicates++;
+                continue;
+            }
+        }
+        // a name sorts before every longer name ending with it, so
+        //  it can't end where the previous one only passed through.
+        assert(lcp < k->strlen);
+
+        // climb back up to where this name branches off
+        while (stack[sp - 1].depth > lcp)
+        {
+            --sp;
+            last = stack[sp].node;
+            last_depth = stack[sp].depth;
+        }
+
+        // it branches off in the middle of the last node we left: cut
+        //  that node in two.  the upper half keeps its slot, so the
+        //  link to it stays valid, and the lower half moves to a new
+        //  slot as its only child.
+        if (stack[sp - 1].depth < lcp)
+        {
+            struct bulk_node *upper = &plan->nodes[last];
+            int64_t y = plan->count++;
+
+            assert(last >= 0 && last_depth > lcp);
+            plan->nodes[y] = *upper;
+            plan->nodes[y].strlen = last_depth - lcp;
+            plan->nodes[y].next = -1;
+            tail[y] = tail[last];
+
+            upper->key += last_depth - lcp;
+            upper->strlen = lcp - stack[sp - 1].depth;
+            upper->ip4_address = 0;
+            upper->children = y;
+            tail[last] = y;
+
+            stack[sp].node = last;
+            stack[sp].depth = lcp;
+            ++sp;
+        }
+
+        // the rest of the name becomes the last child of the node the
+        //  path now ends at.  sorting guarantees it belongs at the end.
+        z = plan->count++;
+        leaf = &plan->nodes[z];
+        leaf->key = k->key;
+        leaf->strlen = k->strlen - lcp;
+        leaf->ip4_address = k->ip4_address;
+        leaf->children = leaf->next = -1;
+        tail[z] = -1;
+
+        parent = stack[sp - 1].node;
+        if (parent < 0)
+        {
+            if (root_tail < 0)
+                plan->root = z;
+            else
+                plan->nodes[root_tail].next = z;
+            root_tail = z;
+        }
+        else
+        {
+            if (tail[parent] < 0)
+                plan->nodes[parent].children = z;
+            else
+                plan->nodes[tail[parent]].next = z;
+            tail[parent] = z;
+        }
+        stack[sp].node = z;
+        stack[sp].depth = k->strlen;
+        ++sp;
+        plan->records++;
+    }
+
+    free(sorted);
+    free(tail);
+    return 1;
+}
+
+void bulk_plan_free(struct bulk_plan *plan)
+{
+    free(plan->nodes);
+    memset(plan, 0, sizeof(*plan));
+    plan->root = -1;
+}
@@ -0,0 +1,52 @@
+#ifndef __BULK_H__
+#define __BULK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bottom-up construction of the reverse trie, shared by the
+ * bulk_load() implementations of every variant.
+ *
+ * The records are sorted by reversed name, so that names sharing a
+ * suffix end up next to each other, and then the path-compressed
+ * trie is laid out in a single pass using the longest common suffix
+ * of each name with the one before it.  The result is a "plan": a
+ * flat array of nodes linked by index, with every sibling list in
+ * order of the siblings' last chars.  A variant only has to allocate
+ * one of its own nodes per plan node and file each one under its
+ * parent.
+ *
+ * Records with an empty name, a name longer than BULK_MAX_KEY, a name
+ * the nodes can't store (see key_encodable()) or an address of 0 are
+ * skipped; of several records with the same name only the first one
+ * is kept, as a series of insert()s would.
+ */
+
+#define BULK_MAX_KEY 253
+
+struct bulk_node {
+    const char *key;        /* points into the caller's name */
+    uint32_t strlen;
+    int32_t ip4_address;    /* 0 for interior nodes */
+    int64_t children;       /* index of the first child, or -1 */
+    int64_t next;           /* index of the next sibling, or -1 */
+};
+
+struct bulk_plan {
+    struct bulk_node *nodes;
+    size_t count;
+    int64_t root;           /* index of the first root-level node, or -1 */
+    size_t records;         /* names stored */
+    size_t duplicates;      /* names dropped as repeats */
+    size_t skipped;         /* names dropped as empty, too long, unstorable
+                               or with ip 0 */
+};
+
+/* Returns 0 and prints a message if out of memory.  The plan refers
+ * to the keys, which must stay valid until it has been materialised.
+ */
+int bulk_plan_build(struct bulk_plan *plan, const char **keys,
+                    const size_t *lens, const int32_t *ips, size_t n);
+void bulk_plan_free(struct bulk_plan *plan);
+
+#endif /* __BULK_H__ */
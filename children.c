@@ -0,0 +1,308 @@
+/* Adaptive child containers for trie nodes. */
+#include "children.h"
+#include "slab.h"
+
+#include <string.h>
+
+static const size_t children_size[] = {
+    [CHILDREN_4] = sizeof(struct children4),
+    [CHILDREN_16] = sizeof(struct children16),
+    [CHILDREN_48] = sizeof(struct children48),
+    [CHILDREN_256] = sizeof(struct children256),
+};
+
+_Static_assert(sizeof(struct children256) <= SLAB_MAX_SIZE,
+               "the largest child container must come from the slabs");
+
+// a container shrinks once it is down to this many children, a few
+//  short of what the next size down holds, so a node hovering around
+//  one size doesn't flip between two on every insert and delete.
+static const int children_shrink[] = {
+    [CHILDREN_4] = 0,
+    [CHILDREN_16] = 3,
+    [CHILDREN_48] = 12,
+    [CHILDREN_256] = 40,
+};
+
+static const int children_capacity[] = {
+    [CHILDREN_4] = 4,
+    [CHILDREN_16] = 16,
+    [CHILDREN_48] = 48,
+    [CHILDREN_256] = 256,
+};
+
+void (*children_release)(void *) = slab_free;
+
+static struct children *new_children(int type)
+{
+    struct children *c = slab_alloc(children_size[type]);
+    if (!c)
+        return NULL;
+    memset(c, 0, children_size[type]);
+    c->type = type;
+    return c;
+}
+
+// add a child to a container known to have room for it.
+static void put(struct children *c, unsigned char ch, struct trie_node *child)
+{
+    uint8_t *key;
+    struct trie_node **slot;
+    int i;
+
+    switch (c->type)
+    {
+        case CHILDREN_4:
+            key = ((struct children4 *)c)->key;
+            slot = ((struct children4 *)c)->child;
+            break;
+        case CHILDREN_16:
+            key = ((struct children16 *)c)->key;
+            slot = ((struct children16 *)c)->child;
+            break;
+        case CHILDREN_48:
+        {
+            // slots are packed, and removal keeps them so.
+            struct children48 *n = (struct children48 *)c;
+            assert(!n->index[ch]);
+            n->child[c->count] = child;
+            n->index[ch] = ++c->count;
+            return;
+        }
+        default:
+            assert(!((struct children256 *)c)->child[ch]);
+            ((struct children256 *)c)->child[ch] = child;
+            c->count++;
+            return;
+    }
+
+    // the small ones stay sorted: shift the bigger keys up by one.
+    for (i = c->count; i > 0 && key[i - 1] > ch; --i)
+    {
+        key[i] = key[i - 1];
+        slot[i] = slot[i - 1];
+    }
+    assert(i == 0 || key[i - 1] != ch);
+    key[i] = ch;
+    slot[i] = child;
+    c->count++;
+}
+
+// copy every child of from into a new container of the given type.
+static struct children *resize(const struct children *from, int type)
+{
+    struct children *to = new_children(type);
+    int pos = 0, ch;
+
+    if (!to)
+        return NULL;
+    switch (from->type)
+    {
+        case CHILDREN_4:
+        {
+            const struct children4 *n = (const struct children4 *)from;
+            for (pos = 0; pos < from->count; ++pos)
+                put(to, n->key[pos], n->child[pos]);
+            break;
+        }
+        case CHILDREN_16:
+        {
+            const struct children16 *n = (const struct children16 *)from;
+            for (pos = 0; pos < from->count; ++pos)
+                put(to, n->key[pos], n->child[pos]);
+            break;
+        }
+        case CHILDREN_48:
+        {
+            const struct children48 *n = (const struct children48 *)from;
+            for (ch = 0; ch < 256; ++ch)
+                if (n->index[ch])
+                    put(to, ch, n->child[n->index[ch] - 1]);
+            break;
+        }
+        default:
+        {
+            const struct children256 *n = (const struct children256 *)from;
+            for (ch = 0; ch < 256; ++ch)
+                if (n->child[ch])
+                    put(to, ch, n->child[ch]);
+            break;
+        }
+    }
+    return to;
+}
+
+int children_add(struct children **pc, unsigned char ch, struct trie_node *child)
+{
+    struct children *c = *pc;
+
+    assert(child && !children_find(c, ch));
+    if (!c)
+    {
+        c = new_children(CHILDREN_4);
+        if (!c)
+            return 0;
+    }
+    else if (c->count == children_capacity[c->type])
+    {
+        c = resize(*pc, c->type + 1);
+        if (!c)
+            return 0;
+        children_release(*pc);
+    }
+    put(c, ch, child);
+    *pc = c;
+    return 1;
+}
+
+struct children *children_copy(const struct children *c)
+{
+    struct children *copy = slab_alloc(children_size[c->type]);
+    if (copy)
+        memcpy(copy, c, children_size[c->type]);
+    return copy;
+}
+
+void children_set(struct children *c, unsigned char ch, struct trie_node *child)
+{
+    int i;
+
+    assert(child && children_find(c, ch));
+    switch (c->type)
+    {
+        case CHILDREN_4:
+        {
+            struct children4 *n = (struct children4 *)c;
+            for (i = 0; n->key[i] != ch; ++i)
+                ;
+            __atomic_store_n(&n->child[i], child, __ATOMIC_RELEASE);
+            break;
+        }
+        case CHILDREN_16:
+        {
+            struct children16 *n = (struct children16 *)c;
+            for (i = 0; n->key[i] != ch; ++i)
+                ;
+            __atomic_store_n(&n->child[i], child, __ATOMIC_RELEASE);
+            break;
+        }
+        case CHILDREN_48:
+        {
+            struct children48 *n = (struct children48 *)c;
+            __atomic_store_n(&n->child[n->index[ch] - 1], child, __ATOMIC_RELEASE);
+            break;
+        }
+        default:
+            __atomic_store_n(&((struct children256 *)c)->child[ch], child,
+                             __ATOMIC_RELEASE);
+            break;
+    }
+}
+
+void children_remove(struct children **pc, unsigned char ch)
+{
+    struct children *c = *pc, *smaller;
+    uint8_t *key = NULL;
+    struct trie_node **slot = NULL;
+    int i;
+
+    assert(children_find(c, ch));
+    switch (c->type)
+    {
+        case CHILDREN_4:
+            key = ((struct children4 *)c)->key;
+            slot = ((struct children4 *)c)->child;
+            break;
+        case CHILDREN_16:
+            key = ((struct children16 *)c)->key;
+            slot = ((struct children16 *)c)->child;
+            break;
+        case CHILDREN_48:
+        {
+            // move the last slot into the hole to keep them packed
+            struct children48 *n = (struct children48 *)c;
+            int hole = n->index[ch] - 1, last = c->count - 1;
+            if (hole != last)
+            {
+                for (i = 0; n->index[i] != last + 1; ++i)
+                    ;
+                n->child[hole] = n->child[last];
+                n->index[i] = hole + 1;
+            }
+            n->child[last] = NULL;
+            n->index[ch] = 0;
+            c->count--;
+            break;
+        }
+        default:
+            ((struct children256 *)c)->child[ch] = NULL;
+            c->count--;
+            break;
+    }
+    if (key)
+    {
+        for (i = 0; key[i] != ch; ++i)
+            ;
+        for (c->count--; i < c->count; ++i)
+        {
+            key[i] = key[i + 1];
+            slot[i] = slot[i + 1];
+        }
+    }
+
+    if (c->count == 0)
+    {
+        children_release(c);
+        *pc = NULL;
+    }
+    else if (c->count <= children_shrink[c->type])
+    {
+        // out of memory just leaves it oversized
+        smaller = resize(c, c->type - 1);
+        if (smaller)
+        {
+            children_release(c);
+            *pc = smaller;
+        }
+    }
+}
+
+struct trie_node *children_next(const struct children *c, int *pos)
+{
+    if (!c)
+        return NULL;
+    switch (c->type)
+    {
+        case CHILDREN_4:
+            return *pos < c->count ? ((const struct children4 *)c)->child[(*pos)++] : NULL;
+        case CHILDREN_16:
+            return *pos < c->count ? ((const struct children16 *)c)->child[(*pos)++] : NULL;
+        case CHILDREN_48:
+        {
+            const struct children48 *n = (const struct children48 *)c;
+            while (*pos < 256)
+            {
+                int ch = (*pos)++;
+                if (n->index[ch])
+                    return n->child[n->index[ch] - 1];
+            }
+            return NULL;
+        }
+        default:
+        {
+            const struct children256 *n = (const struct children256 *)c;
+            while (*pos < 256)
+            {
+                struct trie_node *child = n->child[(*pos)++];
+                if (child)
+                    return child;
+            }
+            return NULL;
+        }
+    }
+}
+
+void children_free(struct children *c)
+{
+    slab_free(c);
+}
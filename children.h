@@ -0,0 +1,162 @@
+#ifndef __CHILDREN_H__
+#define __CHILDREN_H__
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Child containers for trie nodes, after the adaptive radix tree
+ * (Leis et al., "The Adaptive Radix Tree", ICDE '13).
+ *
+ * Path compression leaves the children of a node with distinct last
+ * chars, since two that ended alike would have been given a common
+ * parent for that suffix.  So the children are indexed by their last
+ * char, which is the next char of a name still to be matched, and one
+ * lookup per level replaces a walk along a sibling list.
+ *
+ * A container comes in four sizes and is replaced by the next one up
+ * when full and the next one down when it gets sparse:
+ *
+ *   - 4 and 16 children: sorted key bytes next to the child pointers,
+ *     searched linearly and with one SSE2 compare respectively;
+ *   - 48 children: a 256-entry index of slots into 48 pointers;
+ *   - 256 children: a pointer per char.
+ *
+ * Containers come from the slab allocator.  A change that grows or
+ * shrinks one releases the old container (see children_release) and
+ * stores the new one through the pointer passed in, so callers must
+ * hold whatever protects the node that owns it.  Iteration is in char
+ * order, the order siblings used to be kept in.
+ *
+ * Readers that take no lock can't watch a container change under
+ * them.  Writers in front of such readers add and remove children in
+ * a children_copy() instead, and publish it in place of the old one.
+ * Only children_set() is safe on a container in use, as it is a
+ * single release store, which children_find() pairs with an acquire
+ * load (a plain load on x86).  Readers that check afterwards whether
+ * any writer got in, as mutex-trie's do, can do without the copies:
+ * there writers only put off freeing the containers they replace.
+ */
+
+/* Where children_add() and children_remove() send the containers they
+ * replace or empty: slab_free() unless a variant has readers that may
+ * still be in them, in which case it defers the free (epoch_retire()).
+ */
+extern void (*children_release)(void *);
+
+struct trie_node;
+
+enum children_type {
+    CHILDREN_4,
+    CHILDREN_16,
+    CHILDREN_48,
+    CHILDREN_256,
+};
+
+struct children {
+    uint8_t type;
+    uint8_t unused;
+    uint16_t count;
+};
+
+struct children4 {
+    struct children hdr;
+    uint8_t key[4];
+    struct trie_node *child[4];
+};
+
+struct children16 {
+    struct children hdr;
+    uint8_t key[16];
+    struct trie_node *child[16];
+};
+
+struct children48 {
+    struct children hdr;
+    uint8_t index[256];         /* slot + 1, or 0 if absent */
+    struct trie_node *child[48];
+};
+
+struct children256 {
+    struct children hdr;
+    struct trie_node *child[256];
+};
+
+/* The child whose key ends in ch, or NULL. */
+static inline struct trie_node *children_find(const struct children *c,
+                                              unsigned char ch)
+{
+    int i;
+
+    if (!c)
+        return NULL;
+    switch (c->type)
+    {
+        case CHILDREN_4:
+        {
+            const struct children4 *n = (const struct children4 *)c;
+            for (i = 0; i < c->count; ++i)
+                if (n->key[i] == ch)
+                    return __atomic_load_n(&n->child[i], __ATOMIC_ACQUIRE);
+            return NULL;
+        }
+        case CHILDREN_16:
+        {
+            const struct children16 *n = (const struct children16 *)c;
+#ifdef __SSE2__
+            __m128i eq = _mm_cmpeq_epi8(_mm_set1_epi8((char)ch),
+                                        _mm_loadu_si128((const __m128i *)n->key));
+            unsigned int mask = _mm_movemask_epi8(eq) & ((1u << c->count) - 1);
+            return mask ? __atomic_load_n(&n->child[__builtin_ctz(mask)], __ATOMIC_ACQUIRE)
+                        : NULL;
+#else
+            for (i = 0; i < c->count; ++i)
+                if (n->key[i] == ch)
+                    return __atomic_load_n(&n->child[i], __ATOMIC_ACQUIRE);
+            return NULL;
+#endif
+        }
+        case CHILDREN_48:
+        {
+            const struct children48 *n = (const struct children48 *)c;
+            return n->index[ch] ? __atomic_load_n(&n->child[n->index[ch] - 1], __ATOMIC_ACQUIRE)
+                                : NULL;
+        }
+        default:
+            return __atomic_load_n(&((const struct children256 *)c)->child[ch],
+                                   __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Add child under ch, which must not be present yet, growing the
+ * container (or creating it, if *pc is NULL) as needed.  Returns 0 if
+ * out of memory, leaving *pc as it was.
+ */
+int children_add(struct children **pc, unsigned char ch, struct trie_node *child);
+
+/* A copy of a container, to change out of sight of readers.  NULL if
+ * out of memory.
+ */
+struct children *children_copy(const struct children *c);
+
+/* Replace the child under ch, which must be present. */
+void children_set(struct children *c, unsigned char ch, struct trie_node *child);
+
+/* Drop the child under ch, which must be present, shrinking the
+ * container as it empties.  The last one out frees it and sets *pc
+ * to NULL.
+ */
+void children_remove(struct children **pc, unsigned char ch);
+
+/* Iterate in char order: start with *pos = 0, returns NULL after the
+ * last child.
+ */
+struct trie_node *children_next(const struct children *c, int *pos);
+
+/* Free a container, but not the children in it. */
+void children_free(struct children *c);
+
+#endif /* __CHILDREN_H__ */
@@ -0,0 +1,78 @@
+/* Flat combining for whole-shard writers. */
+#include "combine.h"
+
+#include <assert.h>
+
+static inline void pause_hint(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// take every pending request, turning the list (newest first, as it
+//  was pushed) around.
+static struct combine_request *take(struct shard *shard)
+{
+    struct combine_request *list, *fifo = NULL, *next;
+
+    list = __atomic_exchange_n(&shard->pending, NULL, __ATOMIC_ACQUIRE);
+    for (; list; list = next)
+    {
+        next = list->next;
+        list->next = fifo;
+        fifo = list;
+    }
+    return fifo;
+}
+
+// mutex held: apply what is pending, and whatever is posted meanwhile,
+//  up to COMBINE_PASSES lists so that no one combines forever.
+static void run(struct shard *shard, combine_apply apply)
+{
+    struct combine_request *list, *next;
+    int pass;
+
+    for (pass = 0; pass < COMBINE_PASSES && (list = take(shard)); ++pass)
+    {
+        apply(shard, list);
+
+        // a request is gone the moment it is done: next first
+        for (; list; list = next)
+        {
+            next = list->next;
+            __atomic_store_n(&list->done, 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+int combine(struct shard *shard, struct combine_request *req, combine_apply apply)
+{
+    int spins;
+
+    req->done = 0;
+    req->next = __atomic_load_n(&shard->pending, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&shard->pending, &req->next, req, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    // wait for a combiner, or become one. whoever holds the mutex may
+    //  not be running, so the wait ends up blocking on it.
+    for (spins = 0; spins < COMBINE_SPINS; ++spins)
+    {
+        if (__atomic_load_n(&req->done, __ATOMIC_ACQUIRE))
+            return req->ret;
+        if (pthread_mutex_trylock(&shard->mutex) == 0)
+            break;
+        pause_hint();
+    }
+    if (spins == COMBINE_SPINS)
+        pthread_mutex_lock(&shard->mutex);
+
+    // req went on the list before the mutex was ours: either the last
+    //  holder took it and is done with it, or the first pass will.
+    run(shard, apply);
+    pthread_mutex_unlock(&shard->mutex);
+    assert(__atomic_load_n(&req->done, __ATOMIC_ACQUIRE));
+    return req->ret;
+}
@@ -0,0 +1,51 @@
+#ifndef __COMBINE_H__
+#define __COMBINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shard.h"
+
+/* Flat combining for the writers of the variants that lock a whole
+ * shard at once (Hendler et al., "Flat combining and the
+ * synchronization-parallelism tradeoff", SPAA '10).
+ *
+ * Rather than each taking the shard's mutex in turn, writers post
+ * their insert or delete to the shard's list of pending requests and
+ * wait.  Whichever of them gets the mutex applies every request on the
+ * list in one go, with the tree hot in its cache, and marks each one
+ * done.  The others never touch the mutex or the tree: a writer under
+ * contention pays for a push and a spin on its own request instead of
+ * a lock handoff and a walk down cold nodes.
+ *
+ * A request lives on its writer's stack, as a writer has only one in
+ * flight.  Squatting inserts wait on the shard's condition, mutex
+ * held, so they don't go through here.
+ */
+
+#define COMBINE_SPINS 128       /* on the request, before blocking */
+#define COMBINE_PASSES 4        /* over the list, per mutex hold */
+
+enum combine_op { COMBINE_INSERT, COMBINE_DELETE };
+
+struct combine_request {
+    enum combine_op op;
+    const char *string;
+    size_t strlen;
+    int32_t ip4_address;        /* inserts only */
+    int ret;                    /* set by the combiner */
+    int done;                   /* and then this */
+    struct combine_request *next;
+};
+
+/* Apply every request on list, oldest first, setting each one's ret.
+ * Called with the shard's mutex held.
+ */
+typedef void (*combine_apply)(struct shard *shard, struct combine_request *list);
+
+/* Post req to shard and return its ret once it has been applied, by
+ * this thread or by whichever held the mutex.
+ */
+int combine(struct shard *shard, struct combine_request *req, combine_apply apply);
+
+#endif /* __COMBINE_H__ */
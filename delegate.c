@@ -0,0 +1,242 @@
+/* Server threads that own the tree, for clients to delegate to. */
+#include "delegate.h"
+#include "trie.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct delegate_server {
+    pthread_t thread;
+    uint32_t doorbell;          /* rung when it may be parked */
+    int parked;
+    struct delegate_line *lines;    /* one per client */
+} __attribute__((aligned(SLAB_LINE)));
+
+static struct delegate_server *servers = NULL;
+static int nservers = 0, nclients = 0;
+static int stopping = 0;
+static int clients_seen = 0;
+static __thread int client_id = -1;
+
+static inline void pause_hint(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// sleep until *word is no longer value, or anything wakes us.
+static void park(uint32_t *word, uint32_t value)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+    (void)word;
+    (void)value;
+    sched_yield();
+#endif
+}
+
+static void unpark(uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+// run what this server's clients have posted. returns how many.
+static int sweep(struct delegate_server *server)
+{
+    struct delegate_line *line;
+    int i, served = 0;
+    uint32_t state;
+
+    for (i = 0; i < nclients; ++i)
+    {
+        line = &server->lines[i];
+        state = __atomic_load_n(&line->state, __ATOMIC_ACQUIRE);
+        if (state != DELEGATE_POSTED && state != DELEGATE_PARKED)
+            continue;
+
+        switch (line->op)
+        {
+            case DELEGATE_SEARCH:
+                line->ret = search(line->string, line->strlen, &line->ip4_address);
+                break;
+            case DELEGATE_INSERT:
+                line->ret = insert(line->string, line->strlen, line->ip4_address);
+                break;
+            case DELEGATE_DELETE:
+                line->ret = delete(line->string, line->strlen);
+                break;
+        }
+        if (__atomic_exchange_n(&line->state, DELEGATE_DONE, __ATOMIC_ACQ_REL) ==
+            DELEGATE_PARKED)
+            unpark(&line->state);
+        ++served;
+    }
+    return served;
+}
+
+static void *serve(void *arg)
+{
+    struct delegate_server *server = arg;
+    uint32_t doorbell;
+    int idle = 0;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        if (sweep(server))
+            idle = 0;
+        else if (++idle < DELEGATE_IDLE)
+            pause_hint();
+        else
+        {
+            // a client posts, then checks parked; we set parked, then
+            //  sweep once more. one of us sees the other.
+            doorbell = __atomic_load_n(&server->doorbell, __ATOMIC_RELAXED);
+            __atomic_store_n(&server->parked, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (!sweep(server) && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+                park(&server->doorbell, doorbell);
+            __atomic_store_n(&server->parked, 0, __ATOMIC_RELAXED);
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+static void ring(struct delegate_server *server)
+{
+    __atomic_add_fetch(&server->doorbell, 1, __ATOMIC_RELAXED);
+    unpark(&server->doorbell);
+}
+
+int delegate_start(int n, int clients)
+{
+    int i;
+
+    servers = aligned_alloc(SLAB_LINE, n * sizeof(*servers));
+    if (!servers)
+    {
+        fprintf(stderr, "Failed to allocate memory for the servers.\n");
+        return 0;
+    }
+    nservers = n;
+    nclients = clients;
+    stopping = 0;
+    clients_seen = 0;
+    for (i = 0; i < n; ++i)
+    {
+        servers[i].doorbell = 0;
+        servers[i].parked = 0;
+        servers[i].lines = aligned_alloc(SLAB_LINE, clients * sizeof(struct delegate_line));
+        if (!servers[i].lines)
+        {
+            fprintf(stderr, "Failed to allocate memory for the servers.\n");
+            nservers = i;
+            delegate_stop();
+            return 0;
+        }
+        memset(servers[i].lines, 0, clients * sizeof(struct delegate_line));
+        if (pthread_create(&servers[i].thread, NULL, serve, &servers[i]))
+        {
+            fprintf(stderr, "Failed to start server %d.\n", i);
+            free(servers[i].lines);
+            nservers = i;
+            delegate_stop();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void delegate_stop(void)
+{
+    int i;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < nservers; ++i)
+    {
+        ring(&servers[i]);
+        pthread_join(servers[i].thread, NULL);
+        free(servers[i].lines);
+    }
+    free(servers);
+    servers = NULL;
+    nservers = 0;
+}
+
+// post an operation to the name's server and wait for the reply.
+static int delegate(enum delegate_op op, const char *string, size_t strlen,
+                    int32_t *ip4_address)
+{
+    struct delegate_server *server;
+    struct delegate_line *line;
+    uint32_t expected;
+    int spins;
+
+    if (client_id < 0)
+    {
+        client_id = __atomic_fetch_add(&clients_seen, 1, __ATOMIC_RELAXED);
+        if (client_id >= nclients)
+        {
+            fprintf(stderr, "More clients than delegate_start() was told of.\n");
+            abort();
+        }
+    }
+    server = &servers[delegate_server_of(string, strlen, nservers)];
+    line = &server->lines[client_id];
+
+    line->op = op;
+    line->string = string;
+    line->strlen = strlen;
+    line->ip4_address = ip4_address ? *ip4_address : 0;
+    __atomic_store_n(&line->state, DELEGATE_POSTED, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&server->parked, __ATOMIC_RELAXED))
+        ring(server);
+
+    for (spins = 0; spins < DELEGATE_SPINS; ++spins)
+    {
+        if (__atomic_load_n(&line->state, __ATOMIC_ACQUIRE) == DELEGATE_DONE)
+            goto done;
+        pause_hint();
+    }
+    expected = DELEGATE_POSTED;
+    if (__atomic_compare_exchange_n(&line->state, &expected, DELEGATE_PARKED, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&line->state, __ATOMIC_ACQUIRE) != DELEGATE_DONE)
+            park(&line->state, DELEGATE_PARKED);
+
+done:
+    if (ip4_address && line->ret)
+        *ip4_address = line->ip4_address;
+    __atomic_store_n(&line->state, DELEGATE_FREE, __ATOMIC_RELAXED);
+    return line->ret;
+}
+
+int delegate_insert(const char *string, size_t strlen, int32_t ip4_address)
+{
+    return delegate(DELEGATE_INSERT, string, strlen, &ip4_address);
+}
+
+int delegate_search(const char *string, size_t strlen, int32_t *ip4_address)
+{
+    return delegate(DELEGATE_SEARCH, string, strlen, ip4_address);
+}
+
+int delegate_delete(const char *string, size_t strlen)
+{
+    return delegate(DELEGATE_DELETE, string, strlen, NULL);
+}
@@ -0,0 +1,76 @@
+#ifndef __DELEGATE_H__
+#define __DELEGATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shard.h"
+#include "slab.h"
+
+/* Delegation: server threads that own the tree, serving the clients'
+ * operations on it (after Roghanchi et al., "ffwd: delegation is (much)
+ * faster than you think", SOSP '17, and Lozi et al.'s RCL).
+ *
+ * Each server owns a partition of the names: those whose zone (see
+ * shard.h) hashes to it.  A client writes its operation to a line of
+ * its own for that server and waits, spinning for a while and then
+ * parking, for the server to write back the result.  A server sweeps
+ * its clients' lines and runs what it finds with the variant's own
+ * insert(), search() and delete(), so its part of the tree stays in
+ * its caches and nothing is shared with other servers.  An idle server
+ * parks too, until a client rings its doorbell.
+ *
+ * A client has one operation in flight at a time, so the ring between
+ * a client and a server is a single line: a request and its reply.
+ *
+ * Servers may run any variant.  With the sequential trie, which keeps a
+ * tree per partition when delegating, no locks are taken at all.  A
+ * server can't wait for a name to be released, so squatting is not
+ * available.
+ */
+
+#define DELEGATE_SPINS 128      /* on a reply, before parking */
+#define DELEGATE_IDLE 128       /* empty sweeps, before parking */
+
+enum delegate_op { DELEGATE_SEARCH, DELEGATE_INSERT, DELEGATE_DELETE };
+
+// line states
+#define DELEGATE_FREE 0
+#define DELEGATE_POSTED 1
+#define DELEGATE_PARKED 2       /* posted, and the client sleeps */
+#define DELEGATE_DONE 3
+
+struct delegate_line {
+    uint32_t state;
+    enum delegate_op op;
+    const char *string;
+    size_t strlen;
+    int32_t ip4_address;        /* in for inserts, out for searches */
+    int ret;
+} __attribute__((aligned(SLAB_LINE)));
+
+/* The server that owns a name.  Names of one zone share a server, as
+ * they share a shard_of(..., SHARD_MAX): a variant that splits its tree
+ * that way can leave each part to its server alone.
+ */
+static inline unsigned delegate_server_of(const char *string, size_t strlen,
+                                          unsigned nservers)
+{
+    return shard_of(string, strlen, SHARD_MAX) % nservers;
+}
+
+/* Start nservers servers for up to nclients client threads, once the
+ * tree has been init()ed and loaded.  Returns 0 and prints a message
+ * if out of memory or threads.
+ */
+int delegate_start(int nservers, int nclients);
+
+/* Stop the servers, once every client has been joined. */
+void delegate_stop(void);
+
+/* insert(), search() and delete(), run by the name's server. */
+int delegate_insert(const char *string, size_t strlen, int32_t ip4_address);
+int delegate_search(const char *string, size_t strlen, int32_t *ip4_address);
+int delegate_delete(const char *string, size_t strlen);
+
+#endif /* __DELEGATE_H__ */
@@ -0,0 +1,134 @@
+/* Epoch-based reclamation for lock-free readers. */
+#include "epoch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t epoch_global = 1;      // 0 marks a thread outside any epoch
+__thread struct epoch_record *epoch_self = NULL;
+
+static struct epoch_record *records = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+
+// thread exit: the record goes back for the next thread to claim,
+//  along with the blocks still waiting in it.
+static void release_record(void *arg)
+{
+    struct epoch_record *rec = arg;
+
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+    epoch_self = NULL;
+}
+
+static void make_record_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+struct epoch_record *epoch_register(void)
+{
+    struct epoch_record *rec;
+    int expected;
+
+    pthread_once(&record_once, make_record_key);
+    for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next)
+    {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!rec)
+    {
+        // a reader can't go on without one, so there is no falling back
+        rec = aligned_alloc(SLAB_LINE, sizeof(*rec));
+        if (!rec)
+        {
+            fprintf(stderr, "Failed to allocate an epoch record.\n");
+            abort();
+        }
+        memset(rec, 0, sizeof(*rec));
+        rec->in_use = 1;
+        rec->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&records, &rec->next, rec, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    pthread_setspecific(record_key, rec);
+    epoch_self = rec;
+    return rec;
+}
+
+// move the epoch on if every thread inside one is in the current one.
+//  returns the global epoch as it is now.
+static uint64_t try_advance(void)
+{
+    uint64_t global = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE), epoch;
+    struct epoch_record *rec;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next)
+    {
+        epoch = __atomic_load_n(&rec->epoch, __ATOMIC_ACQUIRE);
+        if (epoch && epoch != global)
+            return global;
+    }
+    if (__atomic_compare_exchange_n(&epoch_global, &global, global + 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return global + 1;
+    return global;
+}
+
+// free what this thread retired two epochs or more ago.
+static void collect(struct epoch_record *rec, uint64_t global)
+{
+    size_t n;
+
+    for (n = 0; n < rec->nretired && rec->retired[n].epoch + 2 <= global; ++n)
+        slab_free(rec->retired[n].p);
+    rec->nretired -= n;
+    memmove(rec->retired, rec->retired + n, rec->nretired * sizeof(*rec->retired));
+}
+
+void epoch_retire(void *p)
+{
+    struct epoch_record *rec = epoch_self ? epoch_self : epoch_register();
+    struct epoch_retired *grown;
+    uint64_t global;
+
+    // whatever unlinked p must be visible before the epoch is read, so
+    //  that a reader who entered later can't have found p.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    global = __atomic_load_n(&epoch_global, __ATOMIC_RELAXED);
+
+    if (rec->nretired == rec->capacity)
+    {
+        size_t capacity = rec->capacity ? 2 * rec->capacity : 4 * EPOCH_BATCH;
+        grown = realloc(rec->retired, capacity * sizeof(*grown));
+        // out of memory: leave it to slab_destroy(). waiting out the
+        //  readers instead could wait forever on the caller itself.
+        if (!grown)
+            return;
+        rec->retired = grown;
+        rec->capacity = capacity;
+    }
+    rec->retired[rec->nretired].p = p;
+    rec->retired[rec->nretired++].epoch = global;
+
+    if (++rec->retires % EPOCH_BATCH == 0)
+        collect(rec, try_advance());
+}
+
+void epoch_destroy(void)
+{
+    struct epoch_record *rec;
+
+    for (rec = records; rec; rec = rec->next)
+        rec->nretired = 0;
+}
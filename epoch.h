@@ -0,0 +1,77 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+/* Epoch-based reclamation, for readers that walk the tree without
+ * taking any lock (Fraser, "Practical lock-freedom", 2004).
+ *
+ * A reader brackets its walk with epoch_enter() and epoch_exit(),
+ * which only write to a record of the reader's own, on a line of its
+ * own: readers share nothing that they write.  A writer that unlinks
+ * something passes it to epoch_retire() instead of freeing it.  It
+ * is freed once the global epoch has moved on twice since, which
+ * can only happen after every reader that might still have seen it
+ * has left its read-side section.
+ *
+ * The epoch is moved on by whoever retires, every EPOCH_BATCH blocks,
+ * if no reader is still in an older one.  A reader that stays inside
+ * holds up reclamation (but nothing else) until it leaves.
+ *
+ * Everything the trie frees comes from the slab allocator, so that is
+ * where retired blocks go in the end.  A thread's record, along with
+ * what it retired but hasn't freed yet, passes to the next thread to
+ * start after it exits.
+ */
+
+#define EPOCH_BATCH 64
+
+struct epoch_record {
+    uint64_t epoch;             /* global epoch on entry, or 0 outside */
+    int in_use;                 /* owned by a live thread */
+    struct epoch_record *next;  /* all records, never unlinked */
+    struct epoch_retired {
+        void *p;
+        uint64_t epoch;         /* global epoch when retired */
+    } *retired;                 /* oldest first */
+    size_t nretired, capacity;
+    uint64_t retires;           /* ever, to pace the collection */
+} __attribute__((aligned(SLAB_LINE)));
+
+extern uint64_t epoch_global;
+extern __thread struct epoch_record *epoch_self;
+
+/* This thread's record, claimed on its first use of the epochs. */
+struct epoch_record *epoch_register(void);
+
+static inline void epoch_enter(void)
+{
+    struct epoch_record *rec = epoch_self ? epoch_self : epoch_register();
+
+    // the entry must be visible before any pointer is read, or a
+    //  writer could miss it and free what this thread goes on to see.
+    //  an exchange orders it as a fence would, more cheaply on x86.
+    __atomic_exchange_n(&rec->epoch, __atomic_load_n(&epoch_global, __ATOMIC_RELAXED),
+                        __ATOMIC_SEQ_CST);
+}
+
+static inline void epoch_exit(void)
+{
+    __atomic_store_n(&epoch_self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Free a block from the slabs once no reader can still see it.  It
+ * must already be unreachable for readers that start from now on.
+ * Writers may retire from inside a read-side section of their own.
+ */
+void epoch_retire(void *p);
+
+/* Forget every block retired and not yet freed, as slab_destroy()
+ * takes them all anyway.  No thread may be using the epochs.
+ */
+void epoch_destroy(void);
+
+#endif /* __EPOCH_H__ */
@@ -1,4 +1,7 @@
-/* A simple, (reverse) trie.  Only for use with 1 thread. */
+/* A (reverse) trie for many threads: searches and most inserts take
+ * no lock, and the rest lock just the nodes they change.  Node locks
+ * are optimistic and unlinked nodes are reclaimed with hazard pointers;
+ * see below. */
 
 #include <stddef.h>
 #include <stdio.h>
@@ -6,75 +9,305 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sched.h>
+#include <limits.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #include "trie.h"
+#include "bulk.h"
+#include "hazard.h"
+#include "keys.h"
+#include "node.h"
 
 extern volatile int finished;
 
-struct trie_node {
-    pthread_mutex_t lock;
-    pthread_t thread;
-    int islocked;
-    struct trie_node *next;  /* parent list */
-    unsigned int strlen; /* Length of the key */
-    int32_t ip4_address; /* 4 octets */
-    struct trie_node *children; /* Sorted list of children */
-    char key[64]; /* Up to 64 chars */
-};
+/* The root has an empty key and no address; names hang off its
+ * children.  It is never unlinked, so it is never obsolete. */
+static struct trie_node root;
+
+/* Node locks are optimistic (Leis et al., "The ART of Practical
+ * Synchronization", DaMoN '16).  The lock word of every node (see
+ * node.h) is a version: bit 1 is set while a writer holds the node,
+ * bit 0 once it has been unlinked for good, bit 2 while anyone is
+ * parked waiting for it, and the rest counts the changes made to it.
+ *
+ * Nobody locks a node to read it.  A reader takes its version, reads,
+ * and checks that the version is still the same; if not, what it read
+ * may be torn, and it starts over from the root.  Going down, a child
+ * is only trusted once its parent has been checked after reading the
+ * pointer to it.  A writer turns the version it read into a lock with
+ * one CAS, which fails if anyone changed the node in between, and
+ * unlocking moves the version on.  So a search locks nothing, and a
+ * delete or a split locks just the one or two nodes it changes.
+ *
+ * The common inserts lock nothing either.  Child containers are never
+ * changed once published: a new leaf goes into a copy, which replaces
+ * the old container with one CAS, and a lost race just looks again.
+ * Writers that hold a lock change containers the same way, as inserts
+ * may be racing them.  A node about to be unlinked has its container
+ * swapped for the frozen one first, which no such CAS can expect, so
+ * nothing is added to a node on its way out.  An address goes into a
+ * node with one CAS on the address and version together (see
+ * _nodefill()), which fails if a writer has the node.
+ *
+ * Nodes and child containers that are unlinked are retired instead of
+ * freed, and hazard pointers (see hazard.h) keep them until no walk is
+ * on them.  Each hop publishes the container it looks into in slot 0
+ * and the child it takes in the slot for its depth, and checks the
+ * parent's version after each, so a walk holds the whole path it came
+ * down.  A node's key never changes once it is in the tree: a split
+ * replaces the child whose key it shortens with a copy.
+ */
+#define NODE_OBSOLETE 1u
+#define NODE_LOCKED 2u
+#define NODE_WAITING 4u
+#define NODE_VERSION 8u
+
+/* Anyone who finds a node locked spins a while, as it is held for a
+ * few stores at most, and then parks on the lock word (a futex), to
+ * be woken by the unlock.  How long to spin adapts to how long waits
+ * have turned out to be, per thread as the word has no room for it,
+ * the way glibc's adaptive mutexes do.
+ */
+#define NODE_MIN_SPINS 10
+#define NODE_MAX_SPINS 1000
 
-static struct trie_node * root = NULL;
+static __thread int spin_limit = 100;
 
-void _nodelock(struct trie_node *node)
+static inline void _nodepause(void)
 {
-    fflush(stdout);
-    assert(node);
-    if (node->islocked && pthread_self() == node->thread)
-        return;
-    
-    pthread_mutex_lock(&(node->lock));
-    node->thread = pthread_self();
-    node->islocked = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Sleep until the lock word is no longer value, or anything wakes us. */
+static void _nodewait(uint32_t *word, uint32_t value)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
+
+static void _nodewake(uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+#ifdef DEBUG
+/* Which nodes this thread holds; never more than a parent and child. */
+static __thread struct trie_node *held[2];
+
+static void _nodeheld(struct trie_node *from, struct trie_node *to)
+{
+    int i;
+
+    for (i = 0; i < 2 && held[i] != from; ++i)
+        ;
+    assert(i < 2);
+    held[i] = to;
 }
+#else
+#define _nodeheld(from, to)
+#endif
+
+#define HAZARD_CONTAINER 0
+
+/* Empty, and never freed: the container of a node on its way out. */
+static struct children4 frozen = { .hdr = { .type = CHILDREN_4 } };
+#define CHILDREN_FROZEN ((struct children *)&frozen)
 
-void _nodeunlock(struct trie_node *node)
+_Static_assert(NODE_MAX_DEPTH + 1 <= HAZARD_SLOTS,
+               "a whole path must fit in the hazard slots");
+
+/* The version of a node, once no writer holds it.  Returns 0 if the
+ * node has been unlinked, and the caller has to start over.
+ */
+static int _nodeversion(struct trie_node *node, uint32_t *version)
 {
-    fflush(stdout);
-    if (node == NULL)
-    {
-        printf("*** _nodeunlock thread[%u]\n", (unsigned int)pthread_self());
-        //finished = 1;
-        fflush(stdout);
-        sleep(2);
+    int spins = 0, limit = spin_limit, parked = 0;
+
+    while ((*version = __atomic_load_n(&node->lock, __ATOMIC_ACQUIRE)) & NODE_LOCKED) {
+        if (spins < limit) {
+            ++spins;
+            _nodepause();
+            continue;
+        }
+        // Tell the unlock to wake us, then sleep unless it already has
+        if (*version & NODE_WAITING ||
+            __atomic_compare_exchange_n(&node->lock, version, *version | NODE_WAITING,
+                                        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            _nodewait(&node->lock, *version | NODE_WAITING);
+            parked = 1;
+        }
+    }
+    if (spins) {
+        // Aim for twice the spins that waits have taken lately
+        spin_limit += ((parked ? 2 * limit : 2 * spins) - spin_limit) / 8;
+        if (spin_limit < NODE_MIN_SPINS)
+            spin_limit = NODE_MIN_SPINS;
+        if (spin_limit > NODE_MAX_SPINS)
+            spin_limit = NODE_MAX_SPINS;
     }
+    return !(*version & NODE_OBSOLETE);
+}
+
+/* Whether node is still at version, so that what was read from it
+ * since is good.
+ */
+static int _nodecheck(struct trie_node *node, uint32_t version)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&node->lock, __ATOMIC_RELAXED) == version;
+}
+
+/* Lock node if it is still at version. */
+static int _nodeupgrade(struct trie_node *node, uint32_t version)
+{
+    if (!__atomic_compare_exchange_n(&node->lock, &version, version | NODE_LOCKED,
+                                     0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    _nodeheld(NULL, node);
+    return 1;
+}
+
+/* Lock node at whatever version, unless it has been unlinked. */
+static int _nodelock(struct trie_node *node)
+{
+    uint32_t version;
+
+    do {
+        if (!_nodeversion(node, &version))
+            return 0;
+    } while (!_nodeupgrade(node, version));
+    return 1;
+}
+
+/* Unlock node at the next version, waking anyone parked on it.  Only
+ * the waiting bit can change while it is held.
+ */
+static void _nodeunlock_as(struct trie_node *node, uint32_t obsolete)
+{
+    uint32_t old = __atomic_load_n(&node->lock, __ATOMIC_RELAXED), new;
+
+    assert(old & NODE_LOCKED);
+    _nodeheld(node, NULL);
+    do {
+        new = ((old & ~(NODE_LOCKED | NODE_WAITING)) + NODE_VERSION) | obsolete;
+    } while (!__atomic_compare_exchange_n(&node->lock, &old, new, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (old & NODE_WAITING)
+        _nodewake(&node->lock);
+}
 
-    //assert(node);
-    //if ((!node->islocked) && pthread_self() == node->thread)
-    //  return;
+static void _nodeunlock(struct trie_node *node)
+{
+    _nodeunlock_as(node, 0);
+}
 
-    //assert(node->islocked != 0);
-    node->islocked = 0;
-    pthread_mutex_unlock(&node->lock);
+/* Unlock a node that has just been unlinked, for good. */
+static void _nodeunlock_obsolete(struct trie_node *node)
+{
+    _nodeunlock_as(node, NODE_OBSOLETE);
+}
+
+/* The address and the lock word sit next to each other, 8 bytes
+ * aligned, so that one CAS can fill in the address only while the
+ * node is at a given version. */
+_Static_assert(offsetof(struct trie_node, lock) == offsetof(struct trie_node, ip4_address) + 4 &&
+               offsetof(struct trie_node, ip4_address) % 8 == 0,
+               "ip4_address and lock must share a word");
+
+typedef uint64_t __attribute__((may_alias)) node_word_t;
+
+union node_pair {
+    struct {
+        int32_t ip4_address;
+        uint32_t lock;
+    } f;
+    uint64_t word;
+};
+
+/* Set the address of node, at version, if it has none.  Returns 1 if
+ * it did, 0 if there was one already, or -1 if the node has changed.
+ * The version moves on as if the node had been locked.
+ */
+static int _nodefill(struct trie_node *node, uint32_t version, int32_t ip4_address)
+{
+    union node_pair old = { .f = { 0, version } };
+    union node_pair new = { .f = { ip4_address, version + NODE_VERSION } };
+
+    if (__atomic_compare_exchange_n((node_word_t *)&node->ip4_address, &old.word, new.word,
+                                    0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        return 1;
+    return old.f.lock == version ? 0 : -1;
+}
+
+/* node's container, published in slot 0 and then found still in
+ * place, so that it can be read even as an insert replaces it.
+ */
+static struct children *_nodechildren(struct trie_node *node, void **slots)
+{
+    struct children *c;
+
+    do {
+        c = __atomic_load_n(&node->children, __ATOMIC_ACQUIRE);
+        hazard_set(slots, HAZARD_CONTAINER, c);
+    } while (__atomic_load_n(&node->children, __ATOMIC_ACQUIRE) != c);
+    return c;
+}
+
+/* One hop down, from node (at version, depth hops below the root) to
+ * its child filed under ch, published in the slot for depth + 1.
+ * Returns 1 with the child and its version, 0 if there is no such
+ * child, or -1 if node has changed and the walk has to start over.
+ * node's container is left in slot 0.
+ */
+static int _nodechild(struct trie_node *node, uint32_t version, void **slots, int depth,
+                      unsigned char ch, struct trie_node **child, uint32_t *child_version)
+{
+    struct children *c = _nodechildren(node, slots);
+
+    // The child may not be read until published, and then found still
+    // linked from node
+    if (!_nodecheck(node, version))
+        return -1;
+    *child = children_find(c, ch);
+    hazard_set(slots, depth + 1, *child);
+    if (!_nodecheck(node, version))
+        return -1;
+    if (*child == NULL)
+        return 0;
+    if (!_nodeversion(*child, child_version) || !_nodecheck(node, version))
+        return -1;
+    return 1;
 }
 
 struct trie_node * new_leaf (const char *string, size_t strlen, int32_t ip4_address) {
-    struct trie_node *new_node = malloc(sizeof(struct trie_node));
+    struct trie_node *new_node = slab_alloc(sizeof(struct trie_node));
     if (!new_node) {
         printf ("WARNING: Node memory allocation failed.  Results may be bogus.\n");
         return NULL;
     }
 
-    assert(strlen < 64);
+    assert(strlen <= NODE_MAX_KEY);
     assert(strlen > 0);
 
-    new_node->next = NULL;
-    new_node->strlen = strlen;
-    strncpy(new_node->key, string, strlen);
-    new_node->key[strlen] = '\0';
+    if (!node_set_key(new_node, string, strlen)) {
+        printf ("WARNING: Key memory allocation failed.  Results may be bogus.\n");
+        slab_free(new_node);
+        return NULL;
+    }
     new_node->ip4_address = ip4_address;
     new_node->children = NULL;
-    new_node->islocked = 0;
-    new_node->thread = 0;
-    pthread_mutex_init(&new_node->lock, NULL);
+    new_node->lock = 0;
 
     return new_node;
 }
@@ -82,562 +315,505 @@ struct trie_node * new_leaf (const char *string, size_t strlen, int32_t ip4_addr
 void delete_leaf(struct trie_node *node)
 {
     assert(node);
-    pthread_mutex_destroy(&node->lock);
-    free(node);
+    node_free(node);
     return;
 }
 
-int compare_keys (const char *string1, int len1, const char *string2, int len2, int *pKeylen) {
-    int keylen, offset1, offset2;
-    keylen = len1 < len2 ? len1 : len2;
-    offset1 = len1 - keylen;
-    offset2 = len2 - keylen;
-
-    assert (keylen > 0);
-
-    if (pKeylen)
-      *pKeylen = keylen;
-    return strncmp(&string1[offset1], &string2[offset2], keylen);
+static void _free_node(void *node)
+{
+    delete_leaf(node);
 }
 
-void init(int numthreads) {
-    if (numthreads != 1)
-      printf("WARNING: This Trie is only safe to use with one thread!!!  You have %d!!!\n", numthreads);
+static void _free_children(void *c)
+{
+    children_free(c);
+}
 
-    root = NULL;
+/* Free an unlinked node (and its long key) once no reader can still be
+ * on it.  Its children, if any, have gone to another node. */
+static void _retire_node(struct trie_node *node)
+{
+    assert(node);
+    hazard_retire(node, _free_node);
 }
 
-/* Recursive helper function.
- * Returns a pointer to the node if found.
- * Stores an optional pointer to the 
- * parent, or what should be the parent if not found.
- * 
+/* Publish a copy of old, node's container (which must be held in a
+ * slot), with child added under ch.  Takes no lock.  Returns 1 if
+ * done, 0 if out of memory, or -1 if the container is no longer old.
  */
-struct trie_node * 
-_search (struct trie_node *node, const char *string, size_t strlen) {
+static int _add_child(struct trie_node *node, struct children *old, unsigned char ch,
+                      struct trie_node *child) {
+    struct children *c = NULL;
 
-    int keylen, cmp;
+    if (old && !(c = children_copy(old)))
+        return 0;
+    if (!children_add(&c, ch, child)) {
+        children_free(c);
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&node->children, &old, c, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        children_free(c);
+        return -1;
+    }
+    if (old)
+        hazard_retire(old, _free_children);
+    return 1;
+}
 
-    // First things first, check if we are NULL 
-    if (node == NULL) return NULL;
+/* Replace the child of a locked node under ch, or with child NULL
+ * remove it, in a copy of its container.  Inserts may still add to
+ * the container meanwhile, so this is done again until the CAS takes.
+ * Returns 0 if out of memory.
+ */
+static int _set_child(struct trie_node *node, unsigned char ch, struct trie_node *child) {
+    void **slots = hazard_slots();
+    struct children *old, *c;
+
+    do {
+        old = _nodechildren(node, slots);
+        c = NULL;
+        // The last one out leaves no container at all
+        if (child || old->count > 1) {
+            c = children_copy(old);
+            if (!c)
+                return 0;
+            if (child)
+                children_set(c, ch, child);
+            else
+                children_remove(&c, ch);
+        }
+        if (__atomic_compare_exchange_n(&node->children, &old, c, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+        children_free(c);
+    } while (1);
+    hazard_retire(old, _free_children);
+    return 1;
+}
 
-    assert(node->strlen < 64);
+void init(int numthreads) {
+    // there is only the one tree: don't let a run pass for replicated
+    if (replicas) {
+        printf("ERROR: This Trie can't be replicated (-R); only dns-sequential can.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // See if this key is a substring of the string passed in
-    cmp = compare_keys(node->key, node->strlen, string, strlen, &keylen);
-    if (cmp == 0) {
-        // Yes, either quit, or recur on the children
+    root.children = NULL;
+}
 
-        // If this key is longer than our search string, the key isn't here
-        if (node->strlen > keylen) {
-            return NULL;
-        } else if (strlen > keylen) {
-            // Recur on children list
-            return _search(node->children, string, strlen - keylen);
-        } else {
-            assert (strlen == keylen);
-            return node;
-        }
+/* Helper function.
+ * node's key has been matched; look for the remaining strlen chars
+ * of string below it.  Returns the address stored under the name, or
+ * 0 if there is none.  Takes no locks.
+ */
+int32_t
+_search (struct trie_node *node, const char *string, size_t strlen) {
 
-    } else if (cmp < 0) {
-        // No, look right (the node's key is "less" than the search key)
-        return _search(node->next, string, strlen);
-    } else {
-        // Quit early
-        return 0;
+    struct trie_node *start = node, *child;
+    void **slots = hazard_slots();
+    size_t len = strlen;
+    uint32_t version, child_version;
+    int32_t ip4_address = 0;
+    int depth = 0, found;
+
+restart:
+    hazard_clear(slots, depth + 1);
+    node = start;
+    strlen = len;
+    depth = 0;
+    if (!_nodeversion(node, &version))
+        goto restart;
+
+    // Match one child per level until nothing is left
+    while (strlen > 0) {
+        // The only child that can match is the one ending in our last char
+        found = _nodechild(node, version, slots, depth, string[strlen - 1],
+                           &child, &child_version);
+        if (found < 0)
+            goto restart;
+        if (!found)
+            goto done;
+        assert(child->strlen <= NODE_MAX_KEY);
+
+        // If its key isn't a suffix of our search string, the key isn't here
+        if (node_suffix(child, string, strlen) != child->strlen)
+            goto done;
+
+        strlen -= child->strlen;
+        node = child;
+        version = child_version;
+        depth++;
     }
 
+    // This is the one, if it has an address
+    ip4_address = __atomic_load_n(&node->ip4_address, __ATOMIC_RELAXED);
+    if (!_nodecheck(node, version))
+        goto restart;
+done:
+    hazard_clear(slots, depth + 1);
+    return ip4_address;
 }
 
 
 int search  (const char *string, size_t strlen, int32_t *ip4_address) {
-    struct trie_node *found;
+    int32_t found;
 
     // Skip strings of length 0
     if (strlen == 0)
       return 0;
+    if (!key_encode(string, strlen))
+      return 0;
 
-    found = _search(root, string, strlen);
+    found = _search(&root, string, strlen);
 
     if (found && ip4_address)
-      *ip4_address = found->ip4_address;
+      *ip4_address = found;
 
-    return (found != NULL);
+    return (found != 0);
 }
 
-/* Recursive helper function */
+/* Helper function.  node's key has been matched; file the
+ * remaining strlen chars of string below it.
+ */
 int _insert (const char *string, size_t strlen, int32_t ip4_address, 
-            struct trie_node *node, struct trie_node *parent, struct trie_node *left) {
-
-    int cmp, keylen;
-
-    // First things first, check if we are NULL 
-    assert (node != NULL);
-    assert (node->strlen < 64);
-
-    // both parent and left are non-null is impossible
-    if (parent) {
-        printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-        _nodelock(parent);
-    }
-    if (left) {
-        printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-        _nodelock(left);
-    }
-    // use hand-in-hand lock
-    if (node)
-    {
-        printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-    }else
-    {
-        printf("*** thread[%u], lock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
-    }
-    _nodelock(node);
-
-    // Take the minimum of the two lengths
-    cmp = compare_keys (node->key, node->strlen, string, strlen, &keylen);
-    if (cmp == 0) {
-        // Yes, either quit, or recur on the children
-
-        // If this key is longer than our search string, we need to insert
-        // "above" this node
-        if (node->strlen > keylen) {
-            struct trie_node *new_node;
-
-            assert(keylen == strlen);
-            assert((!parent) || parent->children == node);
-
+            struct trie_node *node) {
+
+    struct trie_node *start = node, *child, *new_node, *head;
+    void **slots = hazard_slots();
+    size_t len = strlen, keylen;
+    uint32_t version, child_version;
+    int depth = 0, found, ret;
+
+restart:
+    hazard_clear(slots, depth + 1);
+    node = start;
+    strlen = len;
+    depth = 0;
+    if (!_nodeversion(node, &version))
+        goto restart;
+
+    while (strlen > 0) {
+        found = _nodechild(node, version, slots, depth, string[strlen - 1],
+                           &child, &child_version);
+        if (found < 0)
+            goto restart;
+
+        if (!found) {
+            // No child ends like we do: insert leaf here.  The container
+            // looked in is still in slot 0, so it can be copied.
             new_node = new_leaf (string, strlen, ip4_address);
-            node->strlen -= keylen;
-            new_node->children = node;
-
-            assert ((!parent) || (!left));
-
-            if (parent) {
-                parent->children = new_node;
-                printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                _nodeunlock(parent);
-            } else if (left) {
-                left->next = new_node;
-                printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                _nodeunlock(left);
-            } else if ((!parent) || (!left)) {
-                root = new_node;
-            }
-
-            if (node){
-                printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-            }
-            else {
-                printf("*** thread[%u], unlock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
-            }
-            _nodeunlock(node);
-            return 1;
-
-        } 
-        else if (strlen > keylen) {
-            if (node->children == NULL) {
-                // Insert leaf here
-                struct trie_node *new_node = new_leaf (string, strlen - keylen, ip4_address);
-                node->children = new_node;
-
-                //printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                if (node){
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                }
-                else {
-                    printf("*** thread[%u], unlock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
-                }
-                _nodeunlock(node);
-                if (parent) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                    _nodeunlock(parent);
-                }
-                if (left) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                    _nodeunlock(left);
-                }
-                return 1;
-            } 
-            else {
-                // Recur on children list, store "parent" (loosely defined)
-                if (parent){
-                  printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                  _nodeunlock(parent);
-                }
-                if (left) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                    _nodeunlock(left);
-                }
-                return _insert(string, strlen - keylen, ip4_address, node->children, node, NULL);
-            }
-        } 
-        else {
-            assert (strlen == keylen);
-            if (node->ip4_address == 0) {
-                node->ip4_address = ip4_address;
-
-                if (parent) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                    _nodeunlock(parent);
-                }
-                if (left) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                    _nodeunlock(left);
-                }
-                //printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                if (node){
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                }
-                else {
-                    printf("*** thread[%u], unlock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
-                }
-                _nodeunlock(node);
-                return 1;
-            } else 
-            {
-                //IF IT FAILS ON READDING IT
-                if (parent) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                    _nodeunlock(parent);
-                }
-                if (left) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                    _nodeunlock(left);
-                }
-                //printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                if (node){
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                }
-                else {
-                    printf("*** thread[%u], unlock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
-                }
-                _nodeunlock(node);
-                return 0;
-            }
-        }
-
-    } 
-    else {
-
-        /* Is there any common substring? */
-        int i, cmp2, keylen2, overlap = 0;
-        for (i = 1; i < keylen; i++) {
-            cmp2 = compare_keys (&node->key[i], node->strlen - i, 
-                        &string[i], strlen - i, &keylen2);
-            assert (keylen2 > 0);
-            if (cmp2 == 0) {
-                overlap = 1;
-                break;
-            }
+            ret = 0;
+            if (new_node)
+                ret = _add_child(node, slots[HAZARD_CONTAINER], string[strlen - 1], new_node);
+            if (ret > 0)
+                goto done;
+            if (new_node)
+                delete_leaf(new_node);
+            if (ret == 0)
+                goto done;
+            // Lost the race: look at this node again
+            if (!_nodeversion(node, &version))
+                goto restart;
+            continue;
         }
-
-        if (overlap) {
-            // Insert a common parent, recur
-            struct trie_node *new_node = new_leaf (&string[i], strlen - i, 0);
-            int diff = node->strlen - i;
-            assert ((node->strlen - diff) > 0);
-            node->strlen -= diff;
-            new_node->children = node;
-            assert ((!parent) || (!left));
-            if (new_node) {
-                printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, new_node->strlen, new_node->key, new_node);
-            }
-            else {
-                printf("*** thread[%u], lock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
+        assert (child->strlen <= NODE_MAX_KEY);
+
+        // How much of the child's key do we share?  At least the last char.
+        keylen = node_suffix(child, string, strlen);
+        if (keylen < child->strlen) {
+            // Insert a common parent holding the shared suffix, and go
+            // on from it (its only child is the old one, for now).
+            // Readers may be on the old one, so rather than shortening
+            // its key it is replaced by a copy with the shorter key,
+            // which takes over its address and children.
+            if (!_nodeupgrade(node, version))
+                goto restart;
+            DEBUG_PRINT("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+            if (!_nodeupgrade(child, child_version)) {
+                DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+                _nodeunlock(node);
+                goto restart;
             }
-            _nodelock(new_node);
-            if (node == root) {
-                new_node->next = node->next;
-                node->next = NULL;
-                root = new_node;
-            } else if (parent) {
-               //assert(parent->children == node);
-                new_node->next = NULL;
-                parent->children = new_node;
-                printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                _nodeunlock(parent);
-            } else if (left) {
-                new_node->next = node->next;
-                node->next = NULL;
-                left->next = new_node;
-                printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                _nodeunlock(left);
-            } else if ((!parent) && (!left)) {
-                root = new_node;
+            DEBUG_PRINT("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, child->strlen, node_text(child), child);
+
+            new_node = new_leaf (&string[strlen - keylen], keylen, 0);
+            head = new_leaf (node_text(child), child->strlen - keylen,
+                             __atomic_load_n(&child->ip4_address, __ATOMIC_RELAXED));
+            if (new_node && head &&
+                !children_add(&new_node->children,
+                              node_char(child, child->strlen - keylen - 1), head)) {
+                delete_leaf(new_node);
+                new_node = NULL;
             }
-
-            return _insert(string, i, ip4_address, node, new_node, NULL);
-        } 
-        else if (cmp < 0) {
-            if (node->next == NULL) {
-                // Insert here
-                struct trie_node *new_node = new_leaf (string, strlen, ip4_address);
-                node->next = new_node;
-                if (parent) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                    _nodeunlock(parent);
-                }
-                if (left) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                    _nodeunlock(left);
-                }
-                //printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                if (node){
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                }
-                else {
-                    printf("*** thread[%u], unlock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
+            if (new_node && head) {
+                // Freezing the old child's container ends inserts into
+                // it, so head takes over all of them
+                head->children = __atomic_exchange_n(&child->children, CHILDREN_FROZEN,
+                                                     __ATOMIC_ACQUIRE);
+                if (!_set_child(node, string[strlen - 1], new_node)) {
+                    __atomic_store_n(&child->children, head->children, __ATOMIC_RELEASE);
+                    children_free(new_node->children);
+                    delete_leaf(new_node);
+                    new_node = NULL;
                 }
+            }
+            if (new_node == NULL || head == NULL) {
+                if (new_node)
+                    delete_leaf(new_node);
+                if (head)
+                    delete_leaf(head);
+                DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, child->strlen, node_text(child), child);
+                _nodeunlock(child);
+                DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
                 _nodeunlock(node);
-                return 1;
-            } else {
-                // No, recur right (the node's key is "greater" than  the search key)
-                if (parent) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-                    _nodeunlock(parent);
-                }
-                if (left) {
-                    printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-                    _nodeunlock(left);
-                }
-                return _insert(string, strlen, ip4_address, node->next, NULL, node);
+                ret = 0;
+                goto done;
             }
-        }
-        else {
-            // Insert here
-            struct trie_node *new_node = new_leaf (string, strlen, ip4_address);
-            new_node->next = node;
-            if (node == root)
-              root = new_node;
-            else if (parent && parent->children == node)
-              parent->children = new_node;
+            // Safe to go on from, as it can't be unlinked while node is
+            // locked
+            hazard_set(slots, depth + 1, new_node);
+
+            DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, child->strlen, node_text(child), child);
+            _nodeunlock_obsolete(child);
+            _retire_node(child);
+            DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+            _nodeunlock(node);
 
+            child = new_node;
+            if (!_nodeversion(child, &child_version))
+                goto restart;
         }
 
-        if (parent) {
-            printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, parent->key, parent);
-            _nodeunlock(parent);
-        }
-        if (left) {
-            printf("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, left->strlen, left->key, left);
-            _nodeunlock(left);
-        }
-        //printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-        if (node){
-            printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-        }
-        else {
-            printf("*** thread[%u], unlock: %d ***\n", (unsigned int)pthread_self(), __LINE__);
-        }
-        _nodeunlock(node);
-        return 1;
+        strlen -= keylen;
+        node = child;
+        version = child_version;
+        depth++;
     }
+
+    // Nothing left: the name ends at this node
+    while ((ret = _nodefill(node, version, ip4_address)) < 0)
+        if (!_nodeversion(node, &version))
+            goto restart;
+done:
+    hazard_clear(slots, depth + 1);
+    return ret;
 }
 
 int insert (const char *string, size_t strlen, int32_t ip4_address) {
     // Skip strings of length 0
     if (strlen == 0)
       return 0;
+    if (!key_encode(string, strlen))
+      return 0;
 
-    /* Edge case: root is null */
-    if (root == NULL) {
-        root = new_leaf (string, strlen, ip4_address);
-        return 1;
-    }
-    return _insert (string, strlen, ip4_address, root, NULL, NULL);
+    return _insert (string, strlen, ip4_address, &root);
 }
 
-/* Recursive helper function.
- * Returns a pointer to the node if found.
- * Stores an optional pointer to the 
- * parent, or what should be the parent if not found.
- * 
+/* Helper function.
+ * node's key has been matched; delete the remaining strlen chars of
+ * string below it.  Returns 1 if the name was found.
+ *
+ * Only the node the name ends at is locked to clear its address.  If
+ * that leaves it with neither children nor an address, it is unlinked
+ * from its parent with both locked, parent first, and so on up for as
+ * long as that leaves the parent empty too.  Anything found changed on
+ * the way up just ends the cleanup; an empty node does no harm.
  */
-struct trie_node * 
-_delete (struct trie_node *node, struct trie_node *pred, const char *string, size_t strlen) {
-    int keylen, cmp;
-
-    // First things first, check if we are NULL 
-    if (node == NULL) return NULL;
-
-    assert(node->strlen < 64);
-
-    // the looking for node could be node or node->next or node->child or none of them
-    if (pred) {
-        printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-        _nodelock(pred);
+int
+_delete (struct trie_node *node, const char *string, size_t strlen) {
+    struct node_path path;
+    struct trie_node *start = node, *child, *parent;
+    void **slots = hazard_slots();
+    size_t len = strlen;
+    uint32_t version, child_version;
+    struct children *expected;
+    unsigned char ch;
+    int depth, found, unlinked, ret = 0;
+
+    path.depth = 0;
+restart:
+    hazard_clear(slots, path.depth + 1);
+    node = start;
+    strlen = len;
+    path.depth = 0;
+    if (!_nodeversion(node, &version))
+        goto restart;
+
+    while (strlen > 0) {
+        found = _nodechild(node, version, slots, path.depth, string[strlen - 1],
+                           &child, &child_version);
+        if (found < 0)
+            goto restart;
+        if (!found)
+            goto done;
+        assert(child->strlen <= NODE_MAX_KEY);
+
+        // If its key isn't a suffix of our search string, the key
+        // isn't here
+        if (node_suffix(child, string, strlen) != child->strlen)
+            goto done;
+
+        assert(path.depth < NODE_MAX_DEPTH);
+        path.node[path.depth] = node;
+        path.ch[path.depth++] = string[strlen - 1];
+        strlen -= child->strlen;
+        node = child;
+        version = child_version;
     }
-    printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-    _nodelock(node);
 
-    // See if this key is a substring of the string passed in
-    cmp = compare_keys (node->key, node->strlen, string, strlen, &keylen);
-    if (cmp == 0) {
-        // Yes, either quit, or recur on the children
-
-        // If this key is longer than our search string, the key isn't here
-        if (node->strlen > keylen) {
-            printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
+    if (!_nodeupgrade(node, version))
+        goto restart;
+    DEBUG_PRINT("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+    /* Just an interior node with no value */
+    if (__atomic_load_n(&node->ip4_address, __ATOMIC_RELAXED) == 0) {
+        DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+        _nodeunlock(node);
+        goto done;
+    }
+    /* We found it! Clear the ip4 address. */
+    __atomic_store_n(&node->ip4_address, 0, __ATOMIC_RELAXED);
+    DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+    _nodeunlock(node);
+
+    ret = 1;
+
+    /* If the node doesn't have children, unlink it.  Otherwise, keep
+     * it around to find the kids.  Every node on the way up is still
+     * in its slot. */
+    for (depth = path.depth; depth > 0; ) {
+        parent = path.node[--depth];
+        ch = path.ch[depth];
+        DEBUG_PRINT("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, node_text(parent), parent);
+        if (!_nodelock(parent))
+            break;
+        DEBUG_PRINT("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+        if (!_nodelock(node)) {
+            DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, node_text(parent), parent);
+            _nodeunlock(parent);
+            break;
+        }
+        // Freezing the container, if it is still empty, ends inserts
+        // below node
+        expected = NULL;
+        unlinked = __atomic_load_n(&node->ip4_address, __ATOMIC_RELAXED) == 0 &&
+            children_find(_nodechildren(parent, slots), ch) == node &&
+            __atomic_compare_exchange_n(&node->children, &expected, CHILDREN_FROZEN, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+        if (unlinked && !_set_child(parent, ch, NULL)) {
+            __atomic_store_n(&node->children, NULL, __ATOMIC_RELEASE);
+            unlinked = 0;
+        }
+        if (!unlinked) {
+            DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
             _nodeunlock(node);
-            if (pred) {
-                printf("*** thread[%u], lock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-                _nodeunlock(pred);
-            }
-            return NULL;
-        } 
-        else if (strlen > keylen) {
-            if (pred) {
-                printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-                _nodeunlock(pred);
-            }
-            struct trie_node *found =  _delete(node->children, node, string, strlen - keylen);
-            if (found) {
-                /* If the node doesn't have children, delete it.
-                 * Otherwise, keep it around to find the kids */
-                if (found->children == NULL && found->ip4_address == 0) {
-                    //assert(node->children == found);
-                    node->children = found->next;
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, found->strlen, found->key, found);
-                    _nodeunlock(found);
-                    delete_leaf(found);
-                    //if (!(node == root && node->children == NULL && node->ip4_address == 0)) {
-                    //    _nodeunlock(node);
-                    //}
-                }
-
-                /* Delete the root node if we empty the tree */
-                if (node == root && node->children == NULL && node->ip4_address == 0) {
-                    root = node->next;
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                    _nodeunlock(node);
-                    delete_leaf(node);
-                }
-                else {
-                      printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                    _nodeunlock(node);
-                }
-
-                return node; /* Recursively delete needless interior nodes */
-            } 
-            else {
-                return NULL;
-            }
+            DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, node_text(parent), parent);
+            _nodeunlock(parent);
+            break;
         }
-        else {
-            assert (strlen == keylen);
-            /* We found it! Clear the ip4 address and return. */
-            if (node->ip4_address) {
-                node->ip4_address = 0;
-
-                /* Delete the root node if we empty the tree */
-                if (node == root && node->children == NULL && node->ip4_address == 0) {
-                    root = node->next;
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                    _nodeunlock(node);
-                    //free(node);
-                    delete_leaf(node);
-                    return (struct trie_node *) 0x100100; /* XXX: Don't use this pointer for anything except 
-                                                           * comparison with NULL, since the memory is freed.
-                                                           * Return a "poison" pointer that will probably 
-                                                           * segfault if used.
-                                                           */
-                }
+        DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node_text(node), node);
+        _nodeunlock_obsolete(node);
+        _retire_node(node);
+        DEBUG_PRINT("*** thread[%u], unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, parent->strlen, node_text(parent), parent);
+        _nodeunlock(parent);
+        node = parent;
+    }
+done:
+    hazard_clear(slots, path.depth + 1);
+    return ret;
+}
 
-                // If node != root && node->children == NULL, it must be in the recursion;
-                // node will be deleted by the upper caller, so node unlock should be operated by upper caller
-                // Else unlock the nodes
-                if (node->children) {
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                    _nodeunlock(node);
-                    if (pred) {
-                        printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-                        _nodeunlock(pred);
-                    }
-                }
-                return node;
-            } 
-            else {
-                /* Just an interior node with no value */
-                printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                _nodeunlock(node);
-                if (pred) {
-                    printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-                    _nodeunlock(pred);
-                }
-                return NULL;
-            }
-        }
+int delete  (const char *string, size_t strlen) {
+    // Skip strings of length 0
+    if (strlen == 0)
+      return 0;
+    if (!key_encode(string, strlen))
+      return 0;
 
-    } 
-    else if (cmp < 0) {
-        // No, look right (the node's key is "less" than  the search key)
-        // The looking for node can not be in pred
-        if (pred) {
-            printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-            _nodeunlock(pred);
-        }
-        struct trie_node *found = _delete(node->next, node, string, strlen);
-        if (found) {
-            /* If the node doesn't have children, delete it.
-             * Otherwise, keep it around to find the kids */
-            if (found->children == NULL && found->ip4_address == 0) {
-                assert(node->next == found);
-                node->next = found->next;
-                printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, found->strlen, found->key, found);
-                _nodeunlock(found);
-                printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-                _nodeunlock(node);
-                delete_leaf(found);
-            }       
+    return _delete(&root, string, strlen);
+}
 
-            return node; /* Recursively delete needless interior nodes */
-        }
+/* Build the tree bottom-up from a sorted plan; see bulk.h */
+int bulk_load (const char **keys, const size_t *lens, const int32_t *ips, size_t n) {
+    struct bulk_plan plan;
+    struct trie_node **nodes;
+    struct children *top = NULL;
+    int64_t j;
+    size_t i;
+    int stored = 0, ok = 1;
+
+    /* Only an empty tree can be built in one go */
+    if (__atomic_load_n(&root.children, __ATOMIC_ACQUIRE) != NULL) {
+        for (i = 0; i < n; i++)
+            if (ips[i] && lens[i] <= BULK_MAX_KEY)
+                stored += insert (keys[i], lens[i], ips[i]);
+        return stored;
+    }
 
-        if (node->next) {
-            printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->next->strlen, node->next->key, node->next);
-            _nodeunlock(node->next);
+    if (!bulk_plan_build (&plan, keys, lens, ips, n))
+        return 0;
+    nodes = malloc (plan.count * sizeof(*nodes) + 1);
+    for (i = 0; nodes && i < plan.count; i++) {
+        nodes[i] = new_leaf (plan.nodes[i].key, plan.nodes[i].strlen,
+                                                  plan.nodes[i].ip4_address);
+        if (!nodes[i]) {
+            while (i > 0)
+                delete_leaf (nodes[--i]);
+            free (nodes);
+            nodes = NULL;
         }
-        printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-        _nodeunlock(node);
-        return NULL;
     }
-    else {
-        // Quit early
-        printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, node->strlen, node->key, node);
-        _nodeunlock(node);
-        if (pred) {
-            printf("*** thread[%u], Unlock: %d, %.*s, node[%p] ***\n", (unsigned int)pthread_self(), __LINE__, pred->strlen, pred->key, pred);
-            _nodeunlock(pred);
+    if (!nodes) {
+        bulk_plan_free (&plan);
+        return 0;
+    }
+
+    /* Each sibling list of the plan becomes a child container */
+    for (i = 0; ok && i < plan.count; i++)
+        for (j = plan.nodes[i].children; ok && j >= 0; j = plan.nodes[j].next)
+            ok = children_add (&nodes[i]->children, node_last(nodes[j]), nodes[j]);
+    for (j = plan.root; ok && j >= 0; j = plan.nodes[j].next)
+        ok = children_add (&top, node_last(nodes[j]), nodes[j]);
+    if (ok) {
+        /* Readers see all of it or none */
+        __atomic_store_n (&root.children, top, __ATOMIC_RELEASE);
+        stored = plan.records;
+    } else {
+        printf ("WARNING: Bulk load ran out of memory.  Nothing was loaded.\n");
+        for (i = 0; i < plan.count; i++) {
+            children_free (nodes[i]->children);
+            delete_leaf (nodes[i]);
         }
-        return NULL;
+        children_free (top);
     }
 
+    free (nodes);
+    bulk_plan_free (&plan);
+    return stored;
 }
 
-int delete  (const char *string, size_t strlen) {
-    // Skip strings of length 0
-    if (strlen == 0)
-      return 0;
-
-    return (NULL != _delete(root, NULL, string, strlen));
+/* Free the whole tree at once: its nodes (and long keys) are all in
+ * the slabs.
+ */
+void destroy() {
+    root.children = NULL;
+    hazard_destroy();
+    slab_destroy();
 }
 
 
 void _print (struct trie_node *node) {
-    printf ("Node at %p.  Key %.*s, IP %d.  Next %p, Children %p\n", 
-                node, node->strlen, node->key, node->ip4_address, node->next, node->children);
-    if (node->children)
-      _print(node->children);
-    if (node->next)
-      _print(node->next);
+    struct trie_node *child;
+    int pos = 0;
+
+    printf ("Node at %p.  Key %.*s, IP %d.  Children %p\n", 
+                node, node->strlen, node_text(node), node->ip4_address, node->children);
+    while ((child = children_next(node->children, &pos)))
+      _print(child);
 }
 
 void print() {
-    printf ("Root is at %p\n", root);
+    printf ("Root is at %p\n", &root);
     /* Do a simple depth-first search */
-    if (root)
-      _print(root);
+    _print(&root);
 }
-
-
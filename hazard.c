@@ -0,0 +1,147 @@
+/* Hazard pointers for lock-free readers. */
+#include "hazard.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+__thread struct hazard_record *hazard_self = NULL;
+
+static struct hazard_record *records = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+
+// thread exit: the record goes back for the next thread to claim,
+//  along with the blocks still waiting in it.
+static void release_record(void *arg)
+{
+    struct hazard_record *rec = arg;
+
+    hazard_clear(rec->slot, HAZARD_SLOTS);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+    hazard_self = NULL;
+}
+
+static void make_record_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+struct hazard_record *hazard_register(void)
+{
+    struct hazard_record *rec;
+    int expected;
+
+    pthread_once(&record_once, make_record_key);
+    for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next)
+    {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!rec)
+    {
+        // a reader can't go on without one, so there is no falling back
+        rec = aligned_alloc(SLAB_LINE, sizeof(*rec));
+        if (!rec)
+        {
+            fprintf(stderr, "Failed to allocate a hazard record.\n");
+            abort();
+        }
+        memset(rec, 0, sizeof(*rec));
+        rec->in_use = 1;
+        rec->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&records, &rec->next, rec, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    pthread_setspecific(record_key, rec);
+    hazard_self = rec;
+    return rec;
+}
+
+static int compare_pointers(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+
+    return (x > y) - (x < y);
+}
+
+// free what this thread retired and no slot holds.  the slots are
+//  gathered and sorted once, so the scan costs one lookup per block.
+static void scan(struct hazard_record *rec)
+{
+    struct hazard_record *head, *r;
+    size_t nrecords = 0, nseen = 0, kept = 0, n;
+    void **seen, *p;
+    int i;
+
+    // whatever unlinked the blocks must be visible before the slots
+    //  are read, so that a reader who checks later finds them gone.
+    //  a thread whose record goes on after head can only have started
+    //  looking after that.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&records, __ATOMIC_ACQUIRE);
+    for (r = head; r; r = r->next)
+        ++nrecords;
+    if (rec->nseen < nrecords * HAZARD_SLOTS)
+    {
+        // out of memory: keep everything, and try again next batch
+        seen = realloc(rec->seen, nrecords * HAZARD_SLOTS * sizeof(*seen));
+        if (!seen)
+            return;
+        rec->seen = seen;
+        rec->nseen = nrecords * HAZARD_SLOTS;
+    }
+
+    for (r = head; r; r = r->next)
+        for (i = 0; i < HAZARD_SLOTS; ++i)
+            if ((p = __atomic_load_n(&r->slot[i], __ATOMIC_ACQUIRE)))
+                rec->seen[nseen++] = p;
+    qsort(rec->seen, nseen, sizeof(*rec->seen), compare_pointers);
+
+    for (n = 0; n < rec->nretired; ++n)
+    {
+        if (bsearch(&rec->retired[n].p, rec->seen, nseen, sizeof(*rec->seen),
+                    compare_pointers))
+            rec->retired[kept++] = rec->retired[n];
+        else
+            rec->retired[n].release(rec->retired[n].p);
+    }
+    rec->nretired = kept;
+}
+
+void hazard_retire(void *p, void (*release)(void *))
+{
+    struct hazard_record *rec = hazard_self ? hazard_self : hazard_register();
+    struct hazard_retired *grown;
+
+    if (rec->nretired == rec->capacity)
+    {
+        size_t capacity = rec->capacity ? 2 * rec->capacity : 4 * HAZARD_BATCH;
+        grown = realloc(rec->retired, capacity * sizeof(*grown));
+        // out of memory: leave it to slab_destroy(). scanning until it
+        //  can go could wait forever on the caller's own slots.
+        if (!grown)
+            return;
+        rec->retired = grown;
+        rec->capacity = capacity;
+    }
+    rec->retired[rec->nretired].p = p;
+    rec->retired[rec->nretired++].release = release;
+
+    if (rec->nretired % HAZARD_BATCH == 0)
+        scan(rec);
+}
+
+void hazard_destroy(void)
+{
+    struct hazard_record *rec;
+
+    for (rec = records; rec; rec = rec->next)
+        rec->nretired = 0;
+}
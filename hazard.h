@@ -0,0 +1,86 @@
+#ifndef __HAZARD_H__
+#define __HAZARD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+/* Hazard pointers, for readers that walk the tree without taking any
+ * lock (Michael, "Hazard pointers: safe memory reclamation for
+ * lock-free objects", IEEE TPDS 2004).
+ *
+ * Before a reader uses a block it found through a shared pointer, it
+ * publishes the block in one of its slots, and then checks that the
+ * block is still linked where it found it.  A writer that unlinks a
+ * block passes it to hazard_retire() instead of freeing it.  Every
+ * HAZARD_BATCH retires, the retiring thread collects what is in every
+ * thread's slots and frees the blocks on its list that no slot holds.
+ *
+ * Unlike epochs (see epoch.h), a reader that stalls only keeps the few
+ * blocks it has published from being freed, not everything retired
+ * after it.  The price is a fence per hop, on publishing.
+ *
+ * A thread has HAZARD_SLOTS slots, enough to keep a whole path down
+ * the trie plus the child container being looked into.  Its record,
+ * along with what it retired but hasn't freed yet, passes to the next
+ * thread to start after it exits.
+ */
+
+#define HAZARD_SLOTS 256
+#define HAZARD_BATCH 64
+
+struct hazard_record {
+    void *slot[HAZARD_SLOTS];   /* published blocks, or NULL */
+    int in_use;                 /* owned by a live thread */
+    struct hazard_record *next; /* all records, never unlinked */
+    struct hazard_retired {
+        void *p;
+        void (*release)(void *);
+    } *retired;
+    size_t nretired, capacity;
+    void **seen;                /* scratch for the scan */
+    size_t nseen;
+} __attribute__((aligned(SLAB_LINE)));
+
+extern __thread struct hazard_record *hazard_self;
+
+/* This thread's record, claimed on its first use of the slots. */
+struct hazard_record *hazard_register(void);
+
+static inline void **hazard_slots(void)
+{
+    return (hazard_self ? hazard_self : hazard_register())->slot;
+}
+
+/* Publish p in slot i.  The caller then has to check that p is still
+ * linked; only then is it safe to use until the slot is reused.
+ */
+static inline void hazard_set(void **slots, int i, void *p)
+{
+    // the slot must be visible before the check, or a writer could
+    //  unlink p after it and miss the slot.  an exchange orders it as
+    //  a fence would, more cheaply on x86.
+    (void)__atomic_exchange_n(&slots[i], p, __ATOMIC_SEQ_CST);
+}
+
+/* Empty the first n slots, once done with the blocks in them. */
+static inline void hazard_clear(void **slots, int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        __atomic_store_n(&slots[i], NULL, __ATOMIC_RELEASE);
+}
+
+/* Free p with release() once no slot holds it.  It must already be
+ * unreachable for readers that start from now on.
+ */
+void hazard_retire(void *p, void (*release)(void *));
+
+/* Forget every block retired and not yet freed, as slab_destroy()
+ * takes them all anyway.  No thread may be using the slots.
+ */
+void hazard_destroy(void);
+
+#endif /* __HAZARD_H__ */
@@ -0,0 +1,45 @@
+/* Packed key encoding, for builds with PACKED_KEYS. */
+#include "keys.h"
+
+#ifdef PACKED_KEYS
+
+__thread struct key_name key_name;
+
+int key_encodable(const char *string, size_t strlen)
+{
+    size_t i;
+
+    for (i = 0; i < strlen; ++i)
+        if (!key_code(string[i]))
+            return 0;
+    return 1;
+}
+
+int key_encode(const char *string, size_t strlen)
+{
+    if (strlen > 253 || !key_pack(key_name.words, string, strlen))
+        return 0;
+    key_name.string = string;
+    key_name.strlen = strlen;
+    return 1;
+}
+
+const char *key_decode(const uint64_t *words, size_t strlen)
+{
+    static __thread char buf[254];
+    size_t i;
+
+    for (i = 0; i < strlen; ++i)
+        buf[strlen - 1 - i] = key_char_at(words, i);
+    buf[strlen] = 0;
+    return buf;
+}
+
+#else
+
+int key_encodable(const char *string, size_t strlen)
+{
+    return 1;
+}
+
+#endif /* PACKED_KEYS */
@@ -0,0 +1,221 @@
+#ifndef __KEYS_H__
+#define __KEYS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Suffix comparison of two keys, shared by every variant and by the
+ * bulk loader.
+ *
+ * key_suffix() walks both keys backwards from their last char and
+ * returns how many trailing chars they have in common, at most the
+ * shorter length.  That one number answers everything a trie walk
+ * asks: whether a node's key is a suffix of the name (the result is
+ * the key's length) and, if not, where to split it.  If pcmp is given
+ * it also gets the order of the two keys by their first differing
+ * char from the end (unsigned, as bulk_load() sorts them), or 0 if
+ * the shorter one is a suffix of the other.
+ *
+ * The keys are compared 32 chars at a time with AVX2 when the build
+ * enables it, 16 at a time with SSE2, and 8 at a time in a 64-bit
+ * word, before finishing char by char.  Loads never reach before the
+ * start of either key.
+ *
+ * Built with PACKED_KEYS (make PACKED=1), trie nodes store their keys
+ * packed instead: 6 bits a char, 10 chars to a 64-bit word, reversed
+ * so that the first word holds the chars a lookup reaches first.  The
+ * 6-bit alphabet covers what DNS names use (a-z, 0-9, '-', '.', plus
+ * '_' and '*'); names with any other char can't be stored.  A name is
+ * packed once, by key_encode(), when it enters search(), insert() or
+ * delete(), and node_suffix() in node.h then matches it against the
+ * nodes a word at a time, with an XOR and a count of trailing zeros.
+ */
+
+// the number of equal trailing bytes of two little-endian words
+static inline size_t key_suffix_word(uint64_t a, uint64_t b)
+{
+    uint64_t x = a ^ b;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return x ? (size_t)__builtin_clzll(x) / 8 : 8;
+#else
+    return x ? (size_t)__builtin_ctzll(x) / 8 : 8;
+#endif
+}
+
+static inline size_t key_suffix(const char *a, size_t alen,
+                                const char *b, size_t blen, int *pcmp)
+{
+    size_t keylen = alen < blen ? alen : blen, n = 0, m;
+    const char *ea = a + alen, *eb = b + blen;
+
+#ifdef __AVX2__
+    for (; n + 32 <= keylen; n += 32)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(ea - n - 32));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(eb - n - 32));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (diff)
+        {
+            n += __builtin_clz(diff);
+            goto differ;
+        }
+    }
+#endif
+#ifdef __SSE2__
+    for (; n + 16 <= keylen; n += 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(ea - n - 16));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(eb - n - 16));
+        uint32_t diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+        if (diff)
+        {
+            n += __builtin_clz(diff) - 16;
+            goto differ;
+        }
+    }
+#endif
+    for (; n + 8 <= keylen; n += 8)
+    {
+        uint64_t wa, wb;
+        memcpy(&wa, ea - n - 8, 8);
+        memcpy(&wb, eb - n - 8, 8);
+        m = key_suffix_word(wa, wb);
+        if (m < 8)
+        {
+            n += m;
+            goto differ;
+        }
+    }
+    for (; n < keylen; ++n)
+        if (ea[-1 - (ptrdiff_t)n] != eb[-1 - (ptrdiff_t)n])
+            goto differ;
+
+    if (pcmp)
+        *pcmp = 0;
+    return keylen;
+
+differ:
+    if (pcmp)
+        *pcmp = (unsigned char)ea[-1 - (ptrdiff_t)n] -
+                (unsigned char)eb[-1 - (ptrdiff_t)n];
+    return n;
+}
+
+/* Whether a name can be stored: always, unless keys are packed. */
+int key_encodable(const char *string, size_t strlen);
+
+#ifdef PACKED_KEYS
+
+#define KEY_PACK_CHARS 10
+#define KEY_PACK_MASK ((1ULL << (6 * KEY_PACK_CHARS)) - 1)
+#define KEY_PACK_WORDS(n) (((n) + KEY_PACK_CHARS - 1) / KEY_PACK_CHARS)
+
+// code 0 pads the last word of a key
+#define KEY_ALPHABET "\0abcdefghijklmnopqrstuvwxyz0123456789-._*"
+
+static inline int key_code(unsigned char c)
+{
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 1;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 27;
+    switch (c)
+    {
+        case '-': return 37;
+        case '.': return 38;
+        case '_': return 39;
+        case '*': return 40;
+        default: return 0;
+    }
+}
+
+// the name being looked up by this thread, packed by key_encode().
+//  string is only kept to check that callers match against it.
+struct key_name {
+    const char *string;
+    size_t strlen;
+    uint64_t words[KEY_PACK_WORDS(253) + 1];
+};
+
+extern __thread struct key_name key_name;
+
+/* Pack the last strlen chars of a name into words, last char first.
+ * Returns 0 if it has a char outside the alphabet.
+ */
+static inline int key_pack(uint64_t *words, const char *string, size_t strlen)
+{
+    size_t i;
+
+    memset(words, 0, KEY_PACK_WORDS(strlen) * sizeof(*words));
+    for (i = 0; i < strlen; ++i)
+    {
+        uint64_t code = key_code(string[strlen - 1 - i]);
+        if (!code)
+            return 0;
+        words[i / KEY_PACK_CHARS] |= code << (6 * (i % KEY_PACK_CHARS));
+    }
+    return 1;
+}
+
+/* The chars of a packed key from pos on, as a word of their own. */
+static inline uint64_t key_window(const uint64_t *words, size_t strlen, size_t pos)
+{
+    size_t w = pos / KEY_PACK_CHARS, r = pos % KEY_PACK_CHARS;
+    uint64_t v = words[w] >> (6 * r);
+
+    if (r && (w + 1) * KEY_PACK_CHARS < strlen)
+        v |= words[w + 1] << (6 * (KEY_PACK_CHARS - r));
+    return v & KEY_PACK_MASK;
+}
+
+static inline unsigned char key_char_at(const uint64_t *words, size_t pos)
+{
+    return KEY_ALPHABET[(words[pos / KEY_PACK_CHARS] >> (6 * (pos % KEY_PACK_CHARS))) & 63];
+}
+
+/* How many chars a packed key (all alen of them) has in common with
+ * the packed key b from bpos on: the packed form of key_suffix().
+ */
+static inline size_t key_packed_common(const uint64_t *a, size_t alen,
+                                       const uint64_t *b, size_t blen, size_t bpos)
+{
+    size_t keylen = alen < blen - bpos ? alen : blen - bpos, i;
+
+    for (i = 0; i < keylen; i += KEY_PACK_CHARS)
+    {
+        uint64_t x = a[i / KEY_PACK_CHARS] ^ key_window(b, blen, bpos + i);
+        if (keylen - i < KEY_PACK_CHARS)
+            x &= (1ULL << (6 * (keylen - i))) - 1;
+        if (x)
+            return i + __builtin_ctzll(x) / 6;
+    }
+    return keylen;
+}
+
+/* Pack a name for the lookups that follow.  Returns 0 if it can't be
+ * stored.
+ */
+int key_encode(const char *string, size_t strlen);
+
+/* The chars of a packed key, for printing, in a buffer that the next
+ * call reuses.
+ */
+const char *key_decode(const uint64_t *words, size_t strlen);
+
+#else
+
+static inline int key_encode(const char *string, size_t strlen)
+{
+    return 1;
+}
+
+#endif /* PACKED_KEYS */
+
+#endif /* __KEYS_H__ */
@@ -1,239 +1,726 @@
-#include "trie.h"
-
-#include <pthread.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <assert.h>
-#include <ctype.h>
-
-int allow_squatting = 0;
-int simulation_length = 30;
-volatile int finished = 0;
-
-//Ahmad Zaraei
-
-// general stress client
-static void *client(void *arg)
-{
-    unsigned int ctx_rand =(unsigned int)(uintptr_t)arg;
-    int i,j,length;
-    int32_t code, ip4_addr;
-    char buf[64];
-
-    while (!finished)
-    {
-        /* Pick a random operation, string, and ip */
-        code = rand_r(&ctx_rand);;
-        length = ((code >> 2) & 0x3E) + 1;
-        
-        /* Generate a random string in lowercase */
-        for (j = 0; j < length; j+= 6)
-        {
-            int32_t chars = rand_r(&ctx_rand);
-            for (i = 0; i < 6 && (i+j) < length; i++)
-            {
-                char val = ( (chars >> (5 * i)) & 31);
-                if (val > 25)
-                    val = 25;
-                buf[j+i] = 'a' + val;
-            }
-            buf[j+i] = 0;
-        }
-        
-        switch (code % 3)
-        {
-            case 0: // Search
-                search (buf, length, NULL);
-                break;
-        
-            case 1: // insert
-                ip4_addr = rand_r(&ctx_rand)+1;
-                insert (buf, length, ip4_addr);
-                break;
-            
-            case 2: // delete
-                delete (buf, length);
-                break;
-        }
-    }
-
-  return NULL;
-}
-
-static void *squatter_stress(void *arg)
-{
-    unsigned ctx_rand = (unsigned int)(uintptr_t)arg;
-    int32_t ip = rand_r(&ctx_rand);
-    while (!finished)
-    {
-        insert ("abc", 3, ip);
-        insert ("abe", 3, ip+1);
-        insert ("bce", 3, ip+2);
-        insert ("bcc", 3, ip+3);
-        delete ("abc", 3);
-        delete ("abe", 3);
-        delete ("bce", 3);
-        delete ("bcc", 3);
-    }
-    return NULL;
-}
-
-#define die(msg) do {				\
-  print();					\
-  fprintf(stderr, msg);					\
-  exit(1);					\
-  } while (0)
-
-int self_tests()
-{
-    int rv;
-    int32_t ip = 0;
-
-    rv = insert ("abc", 3, 4);
-    if (!rv) die ("Failed to insert key abc\n");
-    rv = delete("abc", 3);
-    if (!rv) die ("Failed to delete key abc\n");
-    print();
-    
-    rv = insert ("google", 6, 5);
-    if (!rv) die ("Failed to insert key google\n");
-    
-    rv = insert ("goggle", 6, 4);
-    if (!rv) die ("Failed to insert key goggle\n");
-    
-    // rv = delete("goggle", 6);
-    // if (!rv) die ("Failed to delete key goggle\n");
-    
-    rv = delete("google", 6);
-    if (!rv) die ("Failed to delete key google\n");
-    
-    rv = insert ("ab", 2, 2);
-    // rv = insert ("ab", 2, 2);//ADDED BY ME
-    if (!rv) die ("Failed to insert key ab\n");
-    
-    rv = insert("bb", 2, 2);
-    if (!rv) die ("Failed to insert key bb\n");
-    
-    print();
-    printf("So far so good\n\n");
-    
-    rv = search("ab", 2, &ip);
-    printf("Rv is %d\n", rv);
-    if (!rv) die ("Failed to find key ab\n");
-    if (ip != 2) die ("Found bad IP for key ab\n");
-    
-    rv = search("aa", 2, NULL);
-    if (rv) die ("Found bogus key aa\n");
-    
-    ip = 0;
-    
-    rv = search("bb", 2, &ip);
-    if (!rv) die ("Failed to find key bb\n");
-    if (ip != 2) die ("Found bad IP for key bb\n");
-    
-    ip = 0;
-    
-    rv = delete("cb", 2);
-    if (rv) die ("deleted bogus key cb\n");
-    
-    rv = delete("bb", 2);
-    if (!rv) die ("Failed to delete real key bb\n");
-    
-    rv = search("ab", 2, &ip);
-    if (!rv) die ("Failed to find key ab\n");
-    if (ip != 2) die ("Found bad IP for key ab\n");
-    
-    ip = 0;
-    
-    rv = delete("ab", 2);
-    if (!rv) die ("Failed to delete real key ab\n");
-    
-    printf("End of self-tests, tree is:\n");
-    print();
-    printf("End of self-tests\n");
-    return 0;
-}
-
-void help() {
-  printf ("DNS Simulator.  Usage: ./dns-[variant] [options]\n\n");
-  printf ("Options:\n");
-  printf ("\t-c numclients - Use numclients threads.\n");
-  printf ("\t-h - Print this help.\n");
-  printf ("\t-l length - Run clients for length seconds.\n");
-  printf ("\t-q  - Allow a client to block (squat) if a requested name is taken.\n");
-  printf ("\t-t  - Stress test name squatting.\n");
-  printf ("\n\n");
-}
-
-int main(int argc, char ** argv)
-{
-    srand((unsigned int)time(NULL));
-    
-    int numthreads = 1; // default to 1
-    int c, i;
-    pthread_t *tinfo = NULL;
-    int stress_squatting = 0;
-    
-    // Read options from command line:
-    //   # clients from command line, as well as seed file
-    //   Simulation length
-    //   Block if a name is already taken ("Squat")
-    //   Stress test "squatting"
-    while ((c = getopt (argc, argv, "c:hl:qt")) != -1)
-    {
-        switch (c) {
-            case 'c':
-                numthreads = atoi(optarg);
-                break;
-            case 'h':
-                help();
-                return EXIT_SUCCESS;
-            case 'l':
-                simulation_length = atoi(optarg);
-                break;
-            case 'q':
-                allow_squatting = 1;
-                break;
-            case 't':
-                stress_squatting = 1;
-                break;
-            default:
-                printf ("Unknown option\n");
-                help();
-                return EXIT_FAILURE;
-        }
-    }
-    
-    // Create initial data structure, populate with initial entries
-    // Note: Each variant of the tree has a different init function,
-    // statically compiled in
-    init(numthreads);
-    
-    // Launch client threads
-    tinfo = calloc(numthreads, sizeof(pthread_t));
-    void* (*pfn)(void*) = stress_squatting ? &squatter_stress : &client;
-    for (i = 0; i < numthreads; ++i)
-        pthread_create(tinfo+i, NULL, pfn, (void*)(intptr_t)(i+1));
-    
-    // After the simulation is done, shut it down
-    sleep (simulation_length);
-    finished = 1;
-    
-    // Wait for all clients to exit.  notify implementation it needs
-    //  to have all threads exit their blocking loops.
-    shutdown();
-    
-    // join all running threads.
-    fprintf(stderr, "Waiting for threads to finish...\n");
-    for (i = 0; i < numthreads; i++)
-        pthread_join(tinfo[i], NULL);
-    
-    /* Print the final tree for fun */
-   #ifdef DEBUG  
-/* Print the final tree for fun */
-   print();
-    #endif 
-    return 0;
-}
+#include "trie.h"
+#include "stats.h"
+#include "workload.h"
+#include "trace.h"
+#include "zone.h"
+#include "keys.h"
+#include "slab.h"
+#include "delegate.h"
+#include "replica.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <ctype.h>
+#include <time.h>
+
+int allow_squatting = 0;
+int delegate_servers = 0;
+int replicas = 0;
+int simulation_length = 30;
+volatile int finished = 0;
+int generator_only = 0;
+size_t pool_size = 0;
+static pthread_barrier_t start_barrier;
+
+// trace recording (-w) and replay (-r, -H, -T)
+static const char *record_path = NULL;
+static const char *replay_path = NULL;
+static int replay_by_hash = 0;
+static int replay_timed = 0;
+static struct trace_map replay_map;
+static uint64_t run_epoch;              /* stats_clock() at launch */
+static int replay_done = 0;             /* # replayers out of records */
+static uint64_t replay_end = 0;         /* stats_clock() when the last did */
+static int replay_clients = 0;
+static int zone_incremental = 0;        /* -I: load -f with insert() */
+__thread int squatted = 0;
+
+//Ahmad Zaraei
+
+// per-thread state handed to each client at launch
+struct client_args {
+    int id;                     /* 0-based client index */
+    unsigned int seed;          /* rand_r() seed */
+    struct client_stats *stats; /* this thread's counters */
+    struct workload_pool pool;  /* pre-generated ops, if -P was given */
+    struct trace_buffer trace;  /* ops recorded for -w */
+    const struct trace_record **replay;  /* this thread's share of -r */
+    uint64_t *replay_at;        /* ...and when to issue each, in us */
+    uint64_t nreplay;
+};
+
+// stands in for the trie in generator-only mode: touch the name so the
+//  generator's work can't be optimised away, but do nothing else.
+static inline int generator_sink(const char *name, size_t length)
+{
+    return name[0] == name[length-1];
+}
+
+// wrappers that time one trie operation and record its outcome
+static void timed_search(struct client_stats *stats, const char *name,
+                         size_t length)
+{
+    uint64_t start = stats_clock();
+    int rv = generator_only   ? generator_sink(name, length) :
+             delegate_servers ? delegate_search (name, length, NULL) :
+                                search (name, length, NULL);
+    stats_search(stats, rv, stats_clock() - start);
+}
+
+static void timed_insert(struct client_stats *stats, const char *name,
+                         size_t length, int32_t ip)
+{
+    uint64_t start;
+    int rv;
+    squatted = 0;
+    start = stats_clock();
+    rv = generator_only   ? generator_sink(name, length) :
+         delegate_servers ? delegate_insert (name, length, ip) :
+                            insert (name, length, ip);
+    stats_insert(stats, rv, squatted, stats_clock() - start);
+}
+
+static void timed_delete(struct client_stats *stats, const char *name,
+                         size_t length)
+{
+    uint64_t start = stats_clock();
+    int rv = generator_only   ? generator_sink(name, length) :
+             delegate_servers ? delegate_delete (name, length) :
+                                delete (name, length);
+    stats_delete(stats, rv, stats_clock() - start);
+}
+
+// issue one operation of the given type.  workload and trace op codes
+//  share their numbering.
+static inline void run_op(struct client_stats *stats, int type, const char *key,
+                          size_t length, int32_t ip4_address)
+{
+    switch (type)
+    {
+        case WL_SEARCH:
+            timed_search (stats, key, length);
+            break;
+    
+        case WL_INSERT:
+            timed_insert (stats, key, length, ip4_address);
+            break;
+        
+        case WL_DELETE:
+            timed_delete (stats, key, length);
+            break;
+    }
+}
+
+// clients meet main at the barrier once ready, then wait again while
+//  it starts the clock, so that no op is done before the run begins
+static void wait_start(void)
+{
+    pthread_barrier_wait(&start_barrier);
+    pthread_barrier_wait(&start_barrier);
+}
+
+// general stress client
+static void *client(void *arg)
+{
+    struct client_args *args = arg;
+    struct client_stats *stats = args->stats;
+    unsigned int ctx_rand = args->seed;
+    struct workload_pool *pool = NULL;
+    struct workload_op op;
+    char buf[WORKLOAD_MAX_KEY+1];
+
+    // generate this thread's op stream (if any) before the clock starts
+    if (pool_size)
+    {
+        workload_pool_fill(&args->pool, ctx_rand, pool_size);
+        pool = &args->pool;
+    }
+    wait_start();
+
+    while (!finished)
+    {
+        /* Pick a random operation, string, and ip */
+        if (pool)
+            workload_pool_next(pool, &op);
+        else
+            workload_next(&ctx_rand, &op, buf);
+        
+        if (record_path)
+            trace_buffer_append(&args->trace, (enum trace_op)op.type, op.key,
+                                op.length, op.ip4_address,
+                                stats_clock() - run_epoch);
+        run_op(stats, op.type, op.key, op.length, op.ip4_address);
+    }
+
+  return NULL;
+}
+
+// sleep (or, for short waits, spin) until the given run-relative time
+static void wait_until(uint64_t at_ns)
+{
+    uint64_t now = stats_clock() - run_epoch;
+    if (at_ns > now + 50000)
+    {
+        struct timespec ts;
+        uint64_t when = run_epoch + at_ns;
+        ts.tv_sec = when / 1000000000ull;
+        ts.tv_nsec = when % 1000000000ull;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while (!finished && stats_clock() - run_epoch < at_ns)
+        ;
+}
+
+// trace replay client: issue this thread's share of the mapped trace,
+//  either back to back or at the original offsets.
+static void *replayer(void *arg)
+{
+    struct client_args *args = arg;
+    struct client_stats *stats = args->stats;
+    uint64_t k, now, seen;
+
+    wait_start();
+    for (k = 0; k < args->nreplay && !finished; ++k)
+    {
+        const struct trace_record *rec = args->replay[k];
+        if (replay_timed)
+            wait_until(args->replay_at[k] * 1000);
+        run_op(stats, rec->op, rec->key, rec->length, rec->ip4_address);
+    }
+    // keep the latest finish time, so the run ends when the last
+    //  client did and not when main next wakes up to notice
+    now = stats_clock();
+    seen = __atomic_load_n(&replay_end, __ATOMIC_RELAXED);
+    while (seen < now &&
+           !__atomic_compare_exchange_n(&replay_end, &seen, now, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&replay_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// client that replays a record: round-robin, or by key hash, which
+//  keeps every op on one name in its original order.
+static int replay_target(const struct trace_record *rec, uint64_t seq,
+                         int numthreads)
+{
+    uint64_t h = 1469598103934665603ull;
+    int j;
+    if (!replay_by_hash)
+        return seq % numthreads;
+    for (j = 0; j < rec->length; ++j)
+        h = (h ^ (unsigned char)rec->key[j]) * 1099511628211ull;
+    return h % numthreads;
+}
+
+static int replayable(const struct trace_record *rec)
+{
+    return rec->op < TRACE_NOPS && rec->length > 0 &&
+           rec->length <= WORKLOAD_MAX_KEY;
+}
+
+// hand each record of the mapped trace to a client.  The first pass
+//  sizes each client's share, the second fills it in.
+static int split_trace(struct client_args *targs, int numthreads)
+{
+    const struct trace_record *rec;
+    uint64_t i, seq, at_us, skipped = 0;
+    int t;
+
+    for (i = 0, seq = 0, rec = trace_first(&replay_map); i < replay_map.count;
+         ++i, rec = trace_next(rec))
+    {
+        if (replayable(rec))
+            targs[replay_target(rec, seq++, numthreads)].nreplay++;
+        else
+            ++skipped;
+    }
+
+    for (t = 0; t < numthreads; ++t)
+    {
+        targs[t].replay = malloc((targs[t].nreplay + 1) * sizeof(*targs[t].replay));
+        targs[t].replay_at = malloc((targs[t].nreplay + 1) * sizeof(*targs[t].replay_at));
+        if (!targs[t].replay || !targs[t].replay_at)
+        {
+            perror("Failed to split the trace");
+            return 0;
+        }
+        targs[t].nreplay = 0;
+    }
+
+    for (i = 0, seq = 0, at_us = 0, rec = trace_first(&replay_map);
+         i < replay_map.count; ++i, rec = trace_next(rec))
+    {
+        at_us += rec->gap_us;
+        if (!replayable(rec))
+            continue;
+        t = replay_target(rec, seq++, numthreads);
+        targs[t].replay[targs[t].nreplay] = rec;
+        targs[t].replay_at[targs[t].nreplay] = at_us;
+        targs[t].nreplay++;
+    }
+
+    printf("Replaying %llu records from %s across %d client(s), %s%s\n",
+           (unsigned long long)seq, replay_path, numthreads,
+           replay_by_hash ? "split by name hash" : "round-robin",
+           replay_timed ? ", at recorded times" : ", full speed");
+    if (skipped)
+        printf("Skipped %llu records (bad op or name longer than %d)\n",
+               (unsigned long long)skipped, WORKLOAD_MAX_KEY);
+    return 1;
+}
+
+static void *squatter_stress(void *arg)
+{
+    struct client_args *args = arg;
+    struct client_stats *stats = args->stats;
+    unsigned ctx_rand = args->seed;
+    int32_t ip = rand_r(&ctx_rand);
+    wait_start();
+    while (!finished)
+    {
+        timed_insert (stats, "abc", 3, ip);
+        timed_insert (stats, "abe", 3, ip+1);
+        timed_insert (stats, "bce", 3, ip+2);
+        timed_insert (stats, "bcc", 3, ip+3);
+        timed_delete (stats, "abc", 3);
+        timed_delete (stats, "abe", 3);
+        timed_delete (stats, "bce", 3);
+        timed_delete (stats, "bcc", 3);
+    }
+    return NULL;
+}
+
+// pre-populate the tree from a zone file, reporting the load rate.
+static int load_zone(const char *path)
+{
+    struct zone_file zone;
+    const char *name;
+    const char **names = NULL;
+    size_t length, *lengths = NULL, kept = 0, cap = 0;
+    int32_t ip, *ips = NULL;
+    uint64_t records = 0, inserted = 0, too_long = 0, unstorable = 0, start;
+    double secs;
+
+    start = stats_clock();
+    if (!zone_open(&zone, path))
+        return 0;
+    while (zone_next(&zone, &name, &length, &ip))
+    {
+        ++records;
+        if (length > WORKLOAD_MAX_KEY || ip == 0)
+        {
+            ++too_long;
+            continue;
+        }
+        // packed keys hold lowercase names only: tell the user, rather
+        //  than let the names pass for duplicates
+        if (!key_encodable(name, length))
+        {
+            if (!unstorable++)
+                fprintf(stderr, "%s: skipping \"%.*s\" and any other name with "
+                        "a char packed keys can't store (a-z 0-9 - . _ * only)\n",
+                        path, (int)length, name);
+            continue;
+        }
+        if (zone_incremental)
+        {
+            inserted += insert (name, length, ip);
+            continue;
+        }
+
+        // collect the records for bulk_load(). names point into the
+        //  mapping, so only the three arrays are allocated.
+        if (kept == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            names = realloc(names, cap * sizeof(*names));
+            lengths = realloc(lengths, cap * sizeof(*lengths));
+            ips = realloc(ips, cap * sizeof(*ips));
+            if (!names || !lengths || !ips)
+            {
+                perror("Failed to allocate memory for load_zone()");
+                exit(EXIT_FAILURE);
+            }
+        }
+        names[kept] = name;
+        lengths[kept] = length;
+        ips[kept] = ip;
+        ++kept;
+    }
+    if (!zone_incremental)
+        inserted = bulk_load (names, lengths, ips, kept);
+    secs = (stats_clock() - start) / 1e9;
+
+    printf("Loaded %s: %llu records, %llu inserted, %llu duplicate, "
+           "%llu skipped (malformed, ip 0 or name > %d chars)\n", path,
+           (unsigned long long)records, (unsigned long long)inserted,
+           (unsigned long long)(records - inserted - too_long - unstorable),
+           (unsigned long long)(zone.malformed + too_long), WORKLOAD_MAX_KEY);
+    if (unstorable)
+        printf("  %llu names not loaded: chars outside the packed key alphabet\n",
+               (unsigned long long)unstorable);
+    printf("Zone %s took %.3f s (%.0f records/s)\n",
+           zone_incremental ? "insert" : "bulk load", secs,
+           secs > 0 ? records / secs : 0.0);
+    free(names);
+    free(lengths);
+    free(ips);
+    zone_close(&zone);
+    return 1;
+}
+
+#define die(msg) do {				\
+  print();					\
+  fprintf(stderr, msg);					\
+  exit(1);					\
+  } while (0)
+
+int self_tests()
+{
+    int rv;
+    int32_t ip = 0;
+
+    rv = insert ("abc", 3, 4);
+    if (!rv) die ("Failed to insert key abc\n");
+    rv = delete("abc", 3);
+    if (!rv) die ("Failed to delete key abc\n");
+    print();
+    
+    rv = insert ("google", 6, 5);
+    if (!rv) die ("Failed to insert key google\n");
+    
+    rv = insert ("goggle", 6, 4);
+    if (!rv) die ("Failed to insert key goggle\n");
+    
+    // rv = delete("goggle", 6);
+    // if (!rv) die ("Failed to delete key goggle\n");
+    
+    rv = delete("google", 6);
+    if (!rv) die ("Failed to delete key google\n");
+    
+    rv = insert ("ab", 2, 2);
+    // rv = insert ("ab", 2, 2);//ADDED BY ME
+    if (!rv) die ("Failed to insert key ab\n");
+    
+    rv = insert("bb", 2, 2);
+    if (!rv) die ("Failed to insert key bb\n");
+    
+    print();
+    printf("So far so good\n\n");
+    
+    rv = search("ab", 2, &ip);
+    printf("Rv is %d\n", rv);
+    if (!rv) die ("Failed to find key ab\n");
+    if (ip != 2) die ("Found bad IP for key ab\n");
+    
+    rv = search("aa", 2, NULL);
+    if (rv) die ("Found bogus key aa\n");
+    
+    ip = 0;
+    
+    rv = search("bb", 2, &ip);
+    if (!rv) die ("Failed to find key bb\n");
+    if (ip != 2) die ("Found bad IP for key bb\n");
+    
+    ip = 0;
+    
+    rv = delete("cb", 2);
+    if (rv) die ("deleted bogus key cb\n");
+    
+    rv = delete("bb", 2);
+    if (!rv) die ("Failed to delete real key bb\n");
+    
+    rv = search("ab", 2, &ip);
+    if (!rv) die ("Failed to find key ab\n");
+    if (ip != 2) die ("Found bad IP for key ab\n");
+    
+    ip = 0;
+    
+    rv = delete("ab", 2);
+    if (!rv) die ("Failed to delete real key ab\n");
+    
+    printf("End of self-tests, tree is:\n");
+    print();
+    printf("End of self-tests\n");
+    return 0;
+}
+
+void help() {
+  printf ("DNS Simulator.  Usage: ./dns-[variant] [options]\n\n");
+  printf ("Options:\n");
+  printf ("\t-c numclients - Use numclients threads.\n");
+  printf ("\t-d keydist - Key popularity: uniform, zipf[:theta] or hotspot[:frac:prob].\n");
+  printf ("\t-f zonefile - Pre-populate the tree from a \"name ip\" zone file.\n");
+  printf ("\t-G - Generator only: run the clients without touching the trie.\n");
+  printf ("\t-H - With -r, split the trace across clients by name hash instead of round-robin.\n");
+  printf ("\t-h - Print this help.\n");
+  printf ("\t-I - Load the -f zone file with one insert() per name instead of bulk_load().\n");
+  printf ("\t-k numkeys - Draw names from a fixed universe of numkeys names (0 = unbounded).\n");
+  printf ("\t-L lendist - Key lengths: uniform:min:max, fixed:n or normal:mean:sd.\n");
+  printf ("\t-l length - Run clients for length seconds.\n");
+  printf ("\t-m S:I:D - Relative weights of search, insert and delete (default 1:1:1).\n");
+  printf ("\t-P numops - Pre-generate numops operations per client before the run.\n");
+  printf ("\t-p percent - Pre-populate this percentage of the key universe.\n");
+  printf ("\t-q  - Allow a client to block (squat) if a requested name is taken.\n");
+  printf ("\t-R numreplicas - Keep numreplicas copies of the trie (0: one per NUMA node) and pin\n"
+          "\t                  the clients to nodes.  dns-sequential only.\n");
+  printf ("\t-r trace - Replay a binary trace instead of generating a workload.\n");
+  printf ("\t-S numservers - Serve the trie from numservers threads that the clients delegate to.\n");
+  printf ("\t-s  - Silent: skip the per-second throughput time series.\n");
+  printf ("\t-T  - With -r, issue operations at their recorded times.\n");
+  printf ("\t-t  - Stress test name squatting.\n");
+  printf ("\t-U  - Back trie node slabs with huge pages.\n");
+  printf ("\t-w trace - Record the generated operations to a binary trace.\n");
+  printf ("\n\n");
+}
+
+int main(int argc, char ** argv)
+{
+    srand((unsigned int)time(NULL));
+    
+    int numthreads = 1; // default to 1
+    int c, i;
+    pthread_t *tinfo = NULL;
+    struct client_args *targs = NULL;
+    int stress_squatting = 0;
+    int time_series = 1;
+    double prefill = 0;
+    const char *zone_path = NULL;
+    
+    // Read options from command line:
+    //   # clients from command line, as well as seed (zone) file
+    //   Simulation length
+    //   Block if a name is already taken ("Squat")
+    //   Stress test "squatting"
+    //   Workload shape: op mix, key lengths, key universe and skew
+    while ((c = getopt (argc, argv, "c:d:f:GHhIk:L:l:m:P:p:qR:r:S:sTtUw:")) != -1)
+    {
+        switch (c) {
+            case 'c':
+                numthreads = atoi(optarg);
+                break;
+            case 'd':
+                if (!workload_parse_keys(optarg))
+                    return EXIT_FAILURE;
+                break;
+            case 'f':
+                zone_path = optarg;
+                break;
+            case 'G':
+                generator_only = 1;
+                break;
+            case 'H':
+                replay_by_hash = 1;
+                break;
+            case 'h':
+                help();
+                return EXIT_SUCCESS;
+            case 'I':
+                zone_incremental = 1;
+                break;
+            case 'k':
+                workload.universe = strtoull(optarg, NULL, 0);
+                break;
+            case 'L':
+                if (!workload_parse_lengths(optarg))
+                    return EXIT_FAILURE;
+                break;
+            case 'l':
+                simulation_length = atoi(optarg);
+                break;
+            case 'm':
+                if (!workload_parse_mix(optarg))
+                    return EXIT_FAILURE;
+                break;
+            case 'P':
+                pool_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'p':
+                prefill = atof(optarg);
+                break;
+            case 'q':
+                allow_squatting = 1;
+                break;
+            case 'R':
+                replicas = atoi(optarg);
+                if (replicas == 0)
+                    replicas = replica_nodes();
+                break;
+            case 'r':
+                replay_path = optarg;
+                break;
+            case 'S':
+                delegate_servers = atoi(optarg);
+                break;
+            case 's':
+                time_series = 0;
+                break;
+            case 'T':
+                replay_timed = 1;
+                break;
+            case 't':
+                stress_squatting = 1;
+                break;
+            case 'U':
+                slab_huge_pages = 1;
+                break;
+            case 'w':
+                record_path = optarg;
+                break;
+            default:
+                printf ("Unknown option\n");
+                help();
+                return EXIT_FAILURE;
+        }
+    }
+    
+    // a server can't wait for a name to be released: it would have to
+    //  serve the delete itself
+    if (delegate_servers < 0 || (delegate_servers && allow_squatting))
+    {
+        printf ("-S needs a number of servers, and can't go with -q\n");
+        return EXIT_FAILURE;
+    }
+    if (replicas < 0 || replicas > REPLICA_MAX || (replicas && delegate_servers))
+    {
+        printf ("-R takes up to %d replicas, and can't go with -S\n", REPLICA_MAX);
+        return EXIT_FAILURE;
+    }
+    
+    // Create initial data structure, populate with initial entries
+    // Note: Each variant of the tree has a different init function,
+    // statically compiled in
+    init(numthreads);
+    if (zone_path && !load_zone(zone_path))
+        return EXIT_FAILURE;
+    
+    // Build the key universe, then optionally seed the tree with its
+    //  most popular names so that searches can hit from the start.
+    workload_setup((unsigned int)rand());
+    if (!stress_squatting)
+        workload_print();
+    if (workload.universe && prefill > 0)
+    {
+        size_t n = (size_t)(workload.universe * (prefill > 100 ? 100 : prefill) / 100);
+        size_t k;
+        int length;
+        for (k = 0; k < n; ++k)
+        {
+            const char *name = workload_key(k, &length);
+            insert (name, length, (int32_t)(k + 1));
+        }
+        printf("Pre-populated %zu of %zu keys\n", n, workload.universe);
+    }
+    
+    // Start the servers, which the clients hand every operation to
+    if (delegate_servers && !generator_only &&
+        !delegate_start(delegate_servers, numthreads))
+        return EXIT_FAILURE;
+    
+    // Launch client threads
+    stats_init(numthreads);
+    tinfo = calloc(numthreads, sizeof(pthread_t));
+    targs = calloc(numthreads, sizeof(struct client_args));
+    void* (*pfn)(void*) = stress_squatting ? &squatter_stress : &client;
+    if (replay_path)
+    {
+        if (!trace_open(&replay_map, replay_path) ||
+            !split_trace(targs, numthreads))
+            return EXIT_FAILURE;
+        pfn = &replayer;
+        replay_clients = numthreads;
+    }
+    pthread_barrier_init(&start_barrier, NULL, numthreads + 1);
+    for (i = 0; i < numthreads; ++i)
+    {
+        targs[i].id = i;
+        targs[i].seed = i+1;
+        targs[i].stats = stats_slot(i);
+        
+        // with replicas, clients are dealt out to the nodes, each then
+        //  working on its own node's copy
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (replicas)
+            replica_pin(&attr, i % replica_nodes());
+        pthread_create(tinfo+i, &attr, pfn, targs+i);
+        pthread_attr_destroy(&attr);
+    }
+    
+    // clients generate their pools, then everyone starts together
+    pthread_barrier_wait(&start_barrier);
+    run_epoch = stats_clock();
+    stats_start();
+    pthread_barrier_wait(&start_barrier);
+    if (pool_size && !stress_squatting)
+        printf("Pre-generated %zu ops per client (%.1f MB each)\n", pool_size,
+               workload_pool_bytes(&targs[0].pool) / 1e6);
+    
+    // After the simulation is done, shut it down. Sample throughput
+    //  once a second so a slowdown as the tree grows is visible.
+    //  A replay ends early once every client has run out of records.
+    for (i = 0; i < simulation_length; ++i)
+    {
+        if (replay_path &&
+            __atomic_load_n(&replay_done, __ATOMIC_ACQUIRE) == replay_clients)
+            break;
+        sleep (1);
+        if (time_series)
+            stats_tick();
+    }
+    finished = 1;
+    
+    // Wait for all clients to exit.  notify implementation it needs
+    //  to have all threads exit their blocking loops.
+    shutdown();
+    
+    // join all running threads.
+    fprintf(stderr, "Waiting for threads to finish...\n");
+    for (i = 0; i < numthreads; i++)
+        pthread_join(tinfo[i], NULL);
+    // only main stops the clock, once no client can count another op.
+    //  a replay that ran out of records ended when its last client did.
+    if (replay_path && replay_done == replay_clients)
+        stats_stop_at(replay_end);
+    else
+        stats_stop();
+    if (delegate_servers && !generator_only)
+        delegate_stop();
+    
+    stats_report();
+    slab_report();
+    if (generator_only)
+        printf("\nGenerator only: %.1f ns per operation per client\n",
+               stats_elapsed() * 1e9 * numthreads /
+               (stats_total_ops() ? stats_total_ops() : 1));
+    if (record_path)
+    {
+        struct trace_buffer *bufs = calloc(numthreads, sizeof(*bufs));
+        for (i = 0; bufs && i < numthreads; i++)
+            bufs[i] = targs[i].trace;
+        if (bufs && trace_merge(record_path, bufs, numthreads))
+            printf("Recorded trace to %s\n", record_path);
+        free(bufs);
+    }
+    for (i = 0; i < numthreads; i++)
+    {
+        workload_pool_free(&targs[i].pool);
+        trace_buffer_free(&targs[i].trace);
+        free(targs[i].replay);
+        free(targs[i].replay_at);
+    }
+    trace_unmap(&replay_map);
+    
+    /* Print the final tree for fun */
+   #ifdef DEBUG  
+/* Print the final tree for fun */
+   print();
+    #endif 
+    destroy();
+    return 0;
+}
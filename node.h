@@ -0,0 +1,244 @@
+#ifndef __NODE_H__
+#define __NODE_H__
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "children.h"
+#include "keys.h"
+#include "slab.h"
+
+/* Trie node layout shared by every variant.
+ *
+ * A node is exactly one cache line: its child container (see
+ * children.h), the address, a lock word, the key itself and the key
+ * length.  Keys of up to NODE_INLINE_KEY chars (nearly every node, as
+ * path compression splits names at each shared suffix) are stored
+ * inline.
+ * Longer ones spill to a separate block from the slab allocator and
+ * the inline bytes hold a pointer to it instead, so a node is never
+ * more than one line wherever its key lives.  Names may be up to
+ * NODE_MAX_KEY chars, the longest a DNS name can be.
+ *
+ * Built with PACKED_KEYS the key is kept packed (see keys.h), which
+ * fits 50 chars in the same bytes instead of 46.  Variants get at keys
+ * only through the helpers below, which work either way: node_suffix()
+ * matches a node against the rest of a name, node_char() and
+ * node_last() give the chars a node is filed under, and node_text()
+ * is for printing.
+ *
+ * The lock word is free for variants that lock individual nodes; the
+ * others leave it 0.
+ *
+ * Every variant hangs the tree off a root node with an empty key and
+ * no address, which is never freed, so the top level of names is a
+ * child container like any other.
+ */
+
+#define NODE_MAX_KEY 253
+
+#define NODE_KEY_BYTES 46
+#ifdef PACKED_KEYS
+#define NODE_INLINE_KEY (NODE_KEY_BYTES / 8 * KEY_PACK_CHARS)
+#else
+#define NODE_INLINE_KEY NODE_KEY_BYTES
+#endif
+
+struct trie_node {
+    struct children *children;  /* indexed by their last char */
+    int32_t ip4_address;        /* 4 octets, 0 for interior nodes */
+    uint32_t lock;              /* per-node lock word */
+    char key[NODE_KEY_BYTES] __attribute__((aligned(8)));
+                                /* the key, or a pointer to it if longer */
+    uint16_t strlen;            /* length of the key */
+} __attribute__((aligned(SLAB_LINE)));
+
+_Static_assert(sizeof(struct trie_node) == SLAB_LINE,
+               "trie_node must fit a single cache line");
+
+/* A walk down from the root passes at most one node per char of the
+ * name, as every key has at least one, plus the root itself.  So the
+ * path a delete keeps, to clean up on its way back, has a fixed bound
+ * however the tree is shaped.
+ */
+#define NODE_MAX_DEPTH (NODE_MAX_KEY + 1)
+
+struct node_path {
+    int depth;
+    struct trie_node *node[NODE_MAX_DEPTH];
+    unsigned char ch[NODE_MAX_DEPTH];   /* the child taken from node[i] */
+};
+
+// the key's bytes: inline, or the block the inline bytes point to.
+static inline void *node_key_data(const struct trie_node *node)
+{
+    void *spilled;
+
+    if (node->strlen <= NODE_INLINE_KEY)
+        return (void *)node->key;
+    memcpy(&spilled, node->key, sizeof(spilled));
+    return spilled;
+}
+
+#ifdef PACKED_KEYS
+
+static inline const uint64_t *node_words(const struct trie_node *node)
+{
+    return node_key_data(node);
+}
+
+/* Returns 0 if a long key can't be allocated, or the key has a char
+ * that can't be packed.
+ */
+static inline int node_set_key(struct trie_node *node, const char *string,
+                               size_t strlen)
+{
+    uint64_t *words = (uint64_t *)node->key;
+
+    assert(strlen > 0 && strlen <= NODE_MAX_KEY);
+    if (strlen > NODE_INLINE_KEY)
+    {
+        words = slab_alloc(KEY_PACK_WORDS(strlen) * sizeof(*words));
+        if (!words)
+            return 0;
+    }
+    if (!key_pack(words, string, strlen))
+    {
+        if (strlen > NODE_INLINE_KEY)
+            slab_free(words);
+        return 0;
+    }
+    if (strlen > NODE_INLINE_KEY)
+        memcpy(node->key, &words, sizeof(words));
+    node->strlen = strlen;
+    return 1;
+}
+
+/* Keep only the first strlen chars of the key, as when a split moves
+ * the tail of the key into a new parent.  Packed, the tail comes
+ * first, so the chars kept move down to the start.  A spilled key
+ * that now fits comes back inline.
+ */
+static inline void node_shorten_key(struct trie_node *node, size_t strlen)
+{
+    uint64_t words[KEY_PACK_WORDS(NODE_MAX_KEY)];
+    uint64_t *old = (uint64_t *)node_words(node);
+    size_t drop = node->strlen - strlen, i;
+
+    assert(strlen > 0 && strlen < node->strlen);
+    for (i = 0; i < KEY_PACK_WORDS(strlen); ++i)
+        words[i] = key_window(old, node->strlen, drop + i * KEY_PACK_CHARS);
+    if (node->strlen > NODE_INLINE_KEY && strlen <= NODE_INLINE_KEY)
+    {
+        slab_free(old);
+        old = (uint64_t *)node->key;
+    }
+    memcpy(old, words, KEY_PACK_WORDS(strlen) * sizeof(*words));
+    node->strlen = strlen;
+}
+
+/* The i-th char of the key. */
+static inline unsigned char node_char(const struct trie_node *node, size_t i)
+{
+    return key_char_at(node_words(node), node->strlen - 1 - i);
+}
+
+/* How many of the key's last chars match the end of the first strlen
+ * chars of the name key_encode() was last given.
+ */
+static inline size_t node_suffix(const struct trie_node *node,
+                                 const char *string, size_t strlen)
+{
+    assert(string == key_name.string && strlen <= key_name.strlen);
+    return key_packed_common(node_words(node), node->strlen, key_name.words,
+                             key_name.strlen, key_name.strlen - strlen);
+}
+
+static inline const char *node_text(const struct trie_node *node)
+{
+    return key_decode(node_words(node), node->strlen);
+}
+
+#else
+
+static inline const char *node_key(const struct trie_node *node)
+{
+    return node_key_data(node);
+}
+
+/* Returns 0 if a long key can't be allocated. */
+static inline int node_set_key(struct trie_node *node, const char *string,
+                               size_t strlen)
+{
+    char *spilled;
+
+    assert(strlen > 0 && strlen <= NODE_MAX_KEY);
+    node->strlen = strlen;
+    if (strlen <= NODE_INLINE_KEY)
+    {
+        memcpy(node->key, string, strlen);
+        return 1;
+    }
+    spilled = slab_alloc(strlen);
+    if (!spilled)
+        return 0;
+    memcpy(spilled, string, strlen);
+    memcpy(node->key, &spilled, sizeof(spilled));
+    return 1;
+}
+
+/* Keep only the first strlen chars of the key, as when a split moves
+ * the tail of the key into a new parent.  A spilled key that now fits
+ * comes back inline.
+ */
+static inline void node_shorten_key(struct trie_node *node, size_t strlen)
+{
+    const char *spilled = node_key(node);
+
+    assert(strlen > 0 && strlen < node->strlen);
+    if (node->strlen > NODE_INLINE_KEY && strlen <= NODE_INLINE_KEY)
+    {
+        memcpy(node->key, spilled, strlen);
+        slab_free((void *)spilled);
+    }
+    node->strlen = strlen;
+}
+
+/* The i-th char of the key. */
+static inline unsigned char node_char(const struct trie_node *node, size_t i)
+{
+    return node_key(node)[i];
+}
+
+/* How many of the key's last chars match the end of the first strlen
+ * chars of the name.
+ */
+static inline size_t node_suffix(const struct trie_node *node,
+                                 const char *string, size_t strlen)
+{
+    return key_suffix(node_key(node), node->strlen, string, strlen, NULL);
+}
+
+static inline const char *node_text(const struct trie_node *node)
+{
+    return node_key(node);
+}
+
+#endif /* PACKED_KEYS */
+
+/* The char a node is filed under in its parent's children. */
+static inline unsigned char node_last(const struct trie_node *node)
+{
+    return node_char(node, node->strlen - 1);
+}
+
+static inline void node_free(struct trie_node *node)
+{
+    if (node->strlen > NODE_INLINE_KEY)
+        slab_free(node_key_data(node));
+    slab_free(node);
+}
+
+#endif /* __NODE_H__ */
@@ -0,0 +1,243 @@
+/* A copy of the tree per NUMA node, in sync through a log of writes. */
+#define _GNU_SOURCE
+#include "replica.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct replica {
+    pthread_rwlock_t lock;      /* written while applying the log */
+    uint64_t applied;           /* log positions applied so far */
+} __attribute__((aligned(SLAB_LINE)));
+
+static struct replica *copies = NULL;
+static int ncopies = 0;
+static replica_apply apply = NULL;
+static struct replica_entry *entries = NULL;
+static uint64_t tail __attribute__((aligned(SLAB_LINE)));  /* next position */
+static int next_self = 0;
+static __thread int self = -1;
+
+// NUMA topology, read once from sysfs: each CPU's node, numbered in
+//  order of the nodes found.
+static int nnodes = 1;
+static int cpu_node[CPU_SETSIZE];
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+static void read_topology(void)
+{
+    char path[64];
+    FILE *f;
+    int node, found = 0, lo, hi, c, n;
+
+    for (node = 0; node < 1024; ++node)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (!(f = fopen(path, "r")))
+            continue;
+        // "0-3,8-11"
+        while ((n = fscanf(f, "%d-%d", &lo, &hi)) >= 1)
+        {
+            if (n == 1)
+                hi = lo;
+            for (c = lo; c <= hi && c < CPU_SETSIZE; ++c)
+                if (c >= 0)
+                    cpu_node[c] = found;
+            if (fgetc(f) != ',')
+                break;
+        }
+        fclose(f);
+        ++found;
+    }
+    if (found)
+        nnodes = found;
+}
+
+int replica_nodes(void)
+{
+    pthread_once(&topology_once, read_topology);
+    return nnodes;
+}
+
+int replica_pin(pthread_attr_t *attr, int node)
+{
+    cpu_set_t cpus;
+    int c, any = 0;
+
+    pthread_once(&topology_once, read_topology);
+    CPU_ZERO(&cpus);
+    for (c = 0; c < CPU_SETSIZE; ++c)
+        if (cpu_node[c] == node % nnodes)
+        {
+            CPU_SET(c, &cpus);
+            any = 1;
+        }
+    return any && pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus) == 0;
+}
+
+static inline void backoff(int *spins)
+{
+    if (++*spins < 100)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+        sched_yield();
+}
+
+// r's lock held for writing: apply the log to it up to target.
+//  appliers publish each position as they go, so that a writer
+//  waiting for a slot sees them pass it.
+static void update(int r, uint64_t target)
+{
+    struct replica *q = &copies[r];
+    struct replica_entry *e;
+    uint64_t p;
+    int ret, spins;
+
+    for (p = q->applied; p < target; ++p)
+    {
+        // a slot is taken before it is filled in
+        e = &entries[p & (REPLICA_LOG - 1)];
+        spins = 0;
+        while (__atomic_load_n(&e->filled, __ATOMIC_ACQUIRE) != p + 1)
+            backoff(&spins);
+
+        ret = apply(r, e);
+        if (e->replica == r)
+            *e->result = ret;
+        __atomic_store_n(&q->applied, p + 1, __ATOMIC_RELEASE);
+    }
+}
+
+int replica_init(int n, replica_apply fn)
+{
+    int r;
+
+    replica_destroy();
+    copies = aligned_alloc(SLAB_LINE, n * sizeof(*copies));
+    entries = aligned_alloc(SLAB_LINE, REPLICA_LOG * sizeof(*entries));
+    if (!copies || !entries)
+    {
+        fprintf(stderr, "Failed to allocate memory for the replicas.\n");
+        replica_destroy();
+        return 0;
+    }
+    memset(entries, 0, REPLICA_LOG * sizeof(*entries));
+    for (r = 0; r < n; ++r)
+    {
+        pthread_rwlock_init(&copies[r].lock, NULL);
+        copies[r].applied = 0;
+    }
+    ncopies = n;
+    apply = fn;
+    tail = 0;
+    next_self = 0;
+    pthread_once(&topology_once, read_topology);
+    return 1;
+}
+
+void replica_destroy(void)
+{
+    int r;
+
+    for (r = 0; r < ncopies; ++r)
+        pthread_rwlock_destroy(&copies[r].lock);
+    free(copies);
+    free(entries);
+    copies = NULL;
+    entries = NULL;
+    ncopies = 0;
+}
+
+int replica_self(void)
+{
+    int cpu;
+
+    if (self < 0)
+    {
+        cpu = sched_getcpu();
+        if (ncopies <= nnodes && cpu >= 0 && cpu < CPU_SETSIZE)
+            self = cpu_node[cpu] % ncopies;
+        else
+            self = __atomic_fetch_add(&next_self, 1, __ATOMIC_RELAXED) % ncopies;
+    }
+    return self;
+}
+
+int replica_write(int r, enum replica_op op, const char *string, size_t strlen,
+                  int32_t ip4_address)
+{
+    uint64_t pos = __atomic_fetch_add(&tail, 1, __ATOMIC_RELAXED);
+    struct replica_entry *e = &entries[pos & (REPLICA_LOG - 1)];
+    int q, spins, result = 0;
+
+    // the slot is free once every replica is past its last use. one
+    //  that lags (it may have no threads at all) is brought up by
+    //  whoever needs the slot.
+    for (q = 0; q < ncopies; ++q)
+    {
+        spins = 0;
+        while (__atomic_load_n(&copies[q].applied, __ATOMIC_ACQUIRE) + REPLICA_LOG <= pos)
+        {
+            if (pthread_rwlock_trywrlock(&copies[q].lock) == 0)
+            {
+                update(q, pos + 1 - REPLICA_LOG);
+                pthread_rwlock_unlock(&copies[q].lock);
+            }
+            else
+                backoff(&spins);
+        }
+    }
+
+    assert(strlen <= REPLICA_NAME);
+    e->op = op;
+    e->ip4_address = ip4_address;
+    e->strlen = strlen;
+    memcpy(e->string, string, strlen);
+    e->replica = r;
+    e->result = &result;
+    __atomic_store_n(&e->filled, pos + 1, __ATOMIC_RELEASE);
+
+    // once r is past pos, whoever applied it there left the result
+    pthread_rwlock_wrlock(&copies[r].lock);
+    update(r, pos + 1);
+    pthread_rwlock_unlock(&copies[r].lock);
+    return result;
+}
+
+void replica_read_begin(int r)
+{
+    uint64_t end = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&copies[r].applied, __ATOMIC_ACQUIRE) < end)
+    {
+        pthread_rwlock_wrlock(&copies[r].lock);
+        update(r, end);
+        pthread_rwlock_unlock(&copies[r].lock);
+    }
+    pthread_rwlock_rdlock(&copies[r].lock);
+}
+
+void replica_read_end(int r)
+{
+    pthread_rwlock_unlock(&copies[r].lock);
+}
+
+void replica_sync(void)
+{
+    uint64_t end = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    int r;
+
+    for (r = 0; r < ncopies; ++r)
+    {
+        pthread_rwlock_wrlock(&copies[r].lock);
+        update(r, end);
+        pthread_rwlock_unlock(&copies[r].lock);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef __REPLICA_H__
+#define __REPLICA_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+/* Node replication: a copy of the tree per NUMA node, kept in sync by
+ * a shared log of writes (Calciu et al., "Black-box concurrent data
+ * structures for NUMA architectures", ASPLOS '17).
+ *
+ * A write takes the next slot of the log, fills it in, and then brings
+ * its own replica up to date, itself included; its result is what it
+ * did there.  Every replica applies the same writes in the same order,
+ * so they all agree.  A read first brings its replica up to the end of
+ * the log, if it lags, and then searches it.  So reads only touch
+ * their own node's copy, and a replica's lock is only ever taken by
+ * threads of its node, save when the log is full: a write that needs a
+ * slot back brings the lagging replica up itself.
+ *
+ * The variant keeps the copies, and applies log entries to them
+ * through the callback it gives replica_init().  Names are copied into
+ * the log, as it outlives the caller.
+ *
+ * A thread's replica is that of the node it runs on.  With more
+ * replicas than nodes, threads are dealt out to them in turn instead.
+ */
+
+#define REPLICA_MAX 64
+#define REPLICA_LOG 4096        /* slots, a power of two */
+#define REPLICA_NAME 254
+
+enum replica_op { REPLICA_INSERT, REPLICA_DELETE };
+
+struct replica_entry {
+    uint64_t filled;            /* log position + 1, once filled in */
+    enum replica_op op;
+    int32_t ip4_address;
+    uint32_t strlen;
+    int replica;                /* the writer's */
+    int *result;                /* where its replica's applier puts it */
+    char string[REPLICA_NAME];
+} __attribute__((aligned(SLAB_LINE)));
+
+/* Apply e to replica r, returning what insert() or delete() would.
+ * Called with r's lock held for writing.
+ */
+typedef int (*replica_apply)(int replica, const struct replica_entry *e);
+
+/* n replicas, none of them lagging.  Returns 0 and prints a message if
+ * out of memory.
+ */
+int replica_init(int n, replica_apply apply);
+
+/* Forget the log and the replicas. */
+void replica_destroy(void);
+
+/* The calling thread's replica. */
+int replica_self(void);
+
+/* Append a write to the log and apply it to replica r (the caller's),
+ * returning its result there.  strlen must be at most REPLICA_NAME.
+ */
+int replica_write(int r, enum replica_op op, const char *string, size_t strlen,
+                  int32_t ip4_address);
+
+/* Bring replica r up to the end of the log and hold it still, for a
+ * read, until replica_read_end().
+ */
+void replica_read_begin(int r);
+void replica_read_end(int r);
+
+/* Bring every replica up to the end of the log. */
+void replica_sync(void);
+
+/* The number of NUMA nodes, 1 if that can't be told. */
+int replica_nodes(void);
+
+/* Have a thread created with attr run on node's CPUs.  Returns 0 if
+ * they can't be told, leaving attr as it was.
+ */
+int replica_pin(pthread_attr_t *attr, int node);
+
+#endif /* __REPLICA_H__ */
@@ -1,5 +1,14 @@
-/* A simple, (reverse) trie.  Only for use with 1 thread. */
+/* A (reverse) trie for many threads, sharded by zone: writers combine
+ * under their shard's mutex, and readers take no lock at all but run
+ * inside an epoch, so nothing they may be on is freed or changed in
+ * place; see below. */
 #include "trie.h"
+#include "bulk.h"
+#include "combine.h"
+#include "epoch.h"
+#include "keys.h"
+#include "node.h"
+#include "shard.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -9,309 +18,329 @@
 #include <pthread.h>
 
 
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t condition = PTHREAD_COND_INITIALIZER;
-pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
-struct trie_node
-{
-    struct trie_node *next;     /* parent list */
-    struct trie_node *children; /* Sorted list of children */
-    size_t strlen;              /* Length of the key */
-    int32_t ip4_address;        /* 4 octets */
-    char *key;                  /* dynamic key */
-} *root = NULL;
+// the names are spread over shards, each a tree of its own under its
+//  own mutex and condition (see shard.h). writers serialize on their
+//  shard's mutex. readers take no lock at all: they run inside an
+//  epoch (see epoch.h), writers retire what they unlink instead of
+//  freeing it, and no node or container is ever changed where a
+//  reader might be looking, see _add_child().
+// a tree hangs off a root node with an empty key and no address,
+//  which is never freed. node layout is in node.h.
+static struct shard *shards = NULL;
+static unsigned nshards = 0;
 
 
 
 static struct trie_node *
 new_leaf(const char *string, size_t strlen, int32_t ip4_address)
 {
-    struct trie_node *new_node = malloc(sizeof(*new_node) +
-                                        (strlen+1)*sizeof(string[0]));
-    if (!new_node)
+    struct trie_node *new_node = slab_alloc(sizeof(*new_node));
+    if (!new_node || !node_set_key(new_node, string, strlen))
     {
+        slab_free(new_node);
         perror("Failed to allocate memory for new_leaf().\n");
         return NULL;
     }
 
-    // populate new node. note the wire-up of the key pointer.
-    new_node->next = new_node->children = NULL;
-    new_node->strlen = strlen;
+    // populate new node. long keys live outside it, see node.h.
+    new_node->children = NULL;
     new_node->ip4_address = ip4_address;
-    new_node->key = (char *)(new_node+1);
-    strncpy(new_node->key, string, strlen);
-    new_node->key[strlen] = 0;
+    new_node->lock = 0;
     return new_node;
 }
 
 
-// local: compares two keys, returning non-zero only if at least
-//  the minimum of len1 or len2 tail-chars match. however many
-//  did match is populated in pKeyLen as an out-parameter if
-//  successful.
-static int compare_keys(const char *string1, size_t len1,
-                        const char *string2, size_t len2,
-                        size_t *pKeylen)
+// local: the shard a name lives in.
+static struct shard *_shard(const char *string, size_t strlen)
 {
-    size_t keylen, offset1, offset2;
-    keylen = len1 < len2 ? len1 : len2;
-    offset1 = len1 - keylen;
-    offset2 = len2 - keylen;
-    assert (keylen > 0);
-    if (pKeylen)
-        *pKeylen = keylen;
-    return strncmp(string1 + offset1, string2 + offset2, keylen);
+    return &shards[shard_of(string, strlen, nshards)];
 }
 
 
-
-
 void init(int numthreads) {
-  printf("Now starting multithreading");fflush(stdout);
-  root = NULL;
+  unsigned i;
+
+  // there is only the one tree: don't let a run pass for replicated
+  if (replicas)
+  {
+      printf("ERROR: This Trie can't be replicated (-R); only dns-sequential can.\n");
+      exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; shards && i < nshards; ++i)
+  {
+      pthread_mutex_destroy(&shards[i].mutex);
+      pthread_cond_destroy(&shards[i].condition);
+  }
+  free(shards);
+
+  // no shards, no tree: there is nothing to fall back on
+  nshards = shard_count(numthreads);
+  shards = aligned_alloc(SLAB_LINE, nshards * sizeof(*shards));
+  if (!shards)
+  {
+      perror("Failed to allocate memory for the shards.\n");
+      abort();
+  }
+  for (i = 0; i < nshards; ++i)
+  {
+      pthread_mutex_init(&shards[i].mutex, NULL);
+      pthread_cond_init(&shards[i].condition, NULL);
+      memset(&shards[i].root, 0, sizeof(shards[i].root));
+      shards[i].pending = NULL;
+  }
 }
 
 
 // invoked by main() thread when shutdown is in progress.
 void shutdown()
 {
-    pthread_mutex_lock(&mutex);
-    finished = 1;
-    pthread_mutex_unlock(&mutex);
+    unsigned i;
 
-    // signal a wakeup for all the squatters
-    if (allow_squatting)
-        pthread_cond_broadcast(&condition);
+    for (i = 0; i < nshards; ++i)
+    {
+        pthread_mutex_lock(&shards[i].mutex);
+        finished = 1;
+        pthread_mutex_unlock(&shards[i].mutex);
+
+        // signal a wakeup for all the squatters
+        if (allow_squatting)
+            pthread_cond_broadcast(&shards[i].condition);
+    }
 }
 
 // helper function for printing the trie
 static void _print (struct trie_node *node, int indent)
 {
-    if (!node)
-        return;
-
+    struct trie_node *child;
+    int pos = 0;
+    
     int i = 0;
     for (;i<indent; ++i)
         DEBUG_PRINT("  ");
-
-    DEBUG_PRINT("Node: %p,  Key: %.*s, IP: %d, Next: %p, Children: %p\n",
-                node, (int)node->strlen, node->key, node->ip4_address,
-                node->next, node->children);
-
-    _print(node->children, indent+1);
-    _print(node->next, indent);
+    
+    DEBUG_PRINT("Node: %p,  Key: %.*s, IP: %d, Children: %p\n",
+                node, (int)node->strlen, node_text(node), node->ip4_address,
+                node->children);
+    
+    while ((child = children_next(node->children, &pos)))
+        _print(child, indent+1);
 }
 
 void print() {
+unsigned i;
 
-pthread_rwlock_rdlock(&lock);
-DEBUG_PRINT("Tree: Root = %p\n", root);
- _print(root, 0);
-pthread_rwlock_unlock(&lock);
+for (i = 0; i < nshards; ++i)
+{
+pthread_mutex_lock(&shards[i].mutex);
+DEBUG_PRINT("Tree: Root = %p\n", &shards[i].root);
+ _print(&shards[i].root, 0);
+pthread_mutex_unlock(&shards[i].mutex);
+}
 }
 
-// helper function for recursive search facility.
+// helper function for the search facility. node's key has already
+//  been matched; look for the remaining strlen chars of the string
+//  below it. safe without the mutex, inside an epoch.
 static struct trie_node *
 _search (struct trie_node *node, const char *string, size_t strlen)
 {
-    // immediate exit on no-node.
-    if (node == NULL)
-        return NULL;
-
-    // See if this key is a substring of the string passed in
-    size_t keylen;
-    int cmp = compare_keys(node->key, node->strlen, string, strlen, &keylen);
-    if (cmp == 0)
+    // one child per level, until there are no chars left to consume
+    while (strlen > 0)
     {
-        // partial match, if the node keylen is longer than the
-        //  input key, we cannot have a match, and cannot have
-        //  sibling or child match, so return NULL.
-        if (node->strlen > strlen)
-            node = NULL;
-
-        // else if there are still chars left in the input key
-        //  to consume, recurse into children.
-        else if (strlen > keylen)
-            node = _search(node->children, string, strlen - keylen);
-
-        // else i we have a winner, but only if there is an ip address
-        //  if there isn't (0), then this must be considered an just an
-        //  intermediate note and should not be returned as the "find"
-        else if (node->ip4_address == 0)
-            node = NULL;
+        // the only child that can match is the one ending in our last char
+        struct trie_node *child = children_find(
+            __atomic_load_n(&node->children, __ATOMIC_ACQUIRE), string[strlen - 1]);
+        if (child == NULL)
+            return NULL;
+        
+        // if its key isn't a tail-substring of the input key, we cannot
+        //  have a match, so return NULL.
+        if (node_suffix(child, string, strlen) != child->strlen)
+            return NULL;
+        
+        // else there may still be chars left to consume, go on from it.
+        strlen -= child->strlen;
+        node = child;
     }
-
-    // if the node's key is "less" than look to the siblings
-    //  of the current node.
-    else if (cmp < 0)
-        node =  _search(node->next, string, strlen);
-
-    // else it is greater, and there can be no possible match
-    else
-        node = NULL;
-
-    // final return value.
-    return node;
+    
+    // this is our node, but only if there is an ip address. if there
+    //  isn't (0), then this must be considered just an intermediate
+    //  node and should not be returned as the "find"
+    return __atomic_load_n(&node->ip4_address, __ATOMIC_RELAXED) ? node : NULL;
 }
 
 
 int search  (const char *string, size_t strlen, int32_t *ip4_address) {
 
  int bFound = 0;
+ int32_t ip = 0;
     if (strlen==0)
         return 0;
+    if (!key_encode(string, strlen))
+        return 0;
 
-  pthread_rwlock_rdlock(&lock);
+  epoch_enter();
   DEBUG_PRINT("search: %.*s\n", (int)strlen, string);
-  struct trie_node *found=_search(root, string, strlen);
-
- if (found && ip4_address)
-    {
-        *ip4_address = found->ip4_address;
-        bFound = 1;
-    }
+  struct trie_node *found=_search(&_shard(string, strlen)->root, string, strlen);
+
+  // a delete may have cleared it since: read the address just once.
+  if (found)
+        ip = __atomic_load_n(&found->ip4_address, __ATOMIC_RELAXED);
+ if (ip && ip4_address)
+        *ip4_address = ip;
+  bFound = (ip != 0);
     
-  pthread_rwlock_unlock(&lock);
+  epoch_exit();
 
  return bFound;
 
 }
 
-static int _insert (const char *string, size_t strlen, int32_t ip4_address,
-                    struct trie_node *node, struct trie_node *parent, struct trie_node *left)
+// local: writers never change a container that readers may be in.
+//  they change a copy and publish it with a release store, so that a
+//  reader finds either the old children or the new ones, and any new
+//  node fully built. the old container is retired.
+static int _add_child(struct trie_node *node, unsigned char ch,
+                      struct trie_node *child)
 {
-    size_t keylen = 0;
-    int cmp;
-
-    // First things first, check if we are NULL
-    assert (node != NULL);
-    assert (node->strlen < 64);
+    struct children *old = node->children, *c = NULL;
 
-    // Take the minimum of the two lengths
-    cmp = compare_keys (node->key, node->strlen, string, strlen, &keylen);
-    if (cmp == 0)
+    if (old && !(c = children_copy(old)))
+        return 0;
+    if (!children_add(&c, ch, child))
     {
-        // goes above the currentnode if its string is longer than ours.
-        if (node->strlen > keylen)
-        {
-            struct trie_node *new_node = new_leaf(string, strlen, ip4_address);
-            node->strlen -= keylen;
-            new_node->children = node;
+        children_free(c);
+        return 0;
+    }
+    __atomic_store_n(&node->children, c, __ATOMIC_RELEASE);
+    if (old)
+        epoch_retire(old);
+    return 1;
+}
 
-            if (parent)
-            {
-                                new_node->next = parent->children;
-                parent->children = new_node;
-            }
-            else if (left)
-            {
-                                new_node->next = left->next;
-                left->next = new_node;
-            }
-            else if ((!parent) || (!left))
-            {
-                root = new_node;
-            }
-            return 1;
+// local: the same for taking a child out.
+static int _remove_child(struct trie_node *node, unsigned char ch)
+{
+    struct children *old = node->children, *c = NULL;
 
-        }
-        else if (strlen > keylen)
-        {
-            if (node->children == NULL)
-            {
-                // Insert leaf here
-                struct trie_node *new_node = new_leaf (string, strlen - keylen, ip4_address);
-                node->children = new_node;
-                return 1;
-            }
-            else
-            {   // Recur on children list, store "parent" (loosely defined)
-                return _insert(string, strlen - keylen, ip4_address,
-                               node->children, node, NULL);
-            }
-        }
-      else {
-            assert (strlen == keylen);
-            if (node->ip4_address == 0)
-                        {
-                node->ip4_address = ip4_address;
-                return 1;
-            }
-                        return 0;
-        }
+    // the last one out leaves no container at all
+    if (old->count > 1)
+    {
+        c = children_copy(old);
+        if (!c)
+            return 0;
+        children_remove(&c, ch);
     }
-    else
-    {   /* Is there any common substring? */
-        int i, cmp2, overlap=0;
-        size_t keylen2 = 0;
-        for (i = 1; i < keylen; i++) {
-            cmp2 = compare_keys (&node->key[i], node->strlen - i,
-                                 &string[i], strlen - i, &keylen2);
-            assert (keylen2 > 0);
-            if (cmp2 == 0) {
-                overlap = 1;
-                break;
-            }
-        }
+    __atomic_store_n(&node->children, c, __ATOMIC_RELEASE);
+    epoch_retire(old);
+    return 1;
+}
 
-        if (overlap) {
-            // Insert a common parent, recur
-            struct trie_node *new_node = new_leaf (&string[i], strlen - i, 0);
-            size_t diff = node->strlen - i;
-            assert ((node->strlen - diff) > 0);
-            node->strlen -= diff;
-            new_node->children = node;
-            assert ((!parent) || (!left));
-
-            if (node == root) {
-                new_node->next = node->next;
-                node->next = NULL;
-                root = new_node;
-            } else if (parent) {
-                assert(parent->children == node);
-                new_node->next = NULL;
-                parent->children = new_node;
-            } else if (left) {
-                new_node->next = node->next;
-                node->next = NULL;
-                left->next = new_node;
-            } else if ((!parent) && (!left)) {
-                root = new_node;
-            }
+// local: free an unlinked node, and its long key, once no reader can
+//  still be on it. its children, if any, are not its to free.
+static void _retire_node(struct trie_node *node)
+{
+    if (node->strlen > NODE_INLINE_KEY)
+        epoch_retire(node_key_data(node));
+    epoch_retire(node);
+}
 
-            return _insert(string, i, ip4_address,
-                           node, new_node, NULL);
-        }
-        else if (cmp < 0)     {
-            if (node->next == NULL)
+// local: hang a new leaf for the remaining strlen chars of the string
+//  off node.
+static int _add_leaf(struct trie_node *node, const char *string, size_t strlen,
+                     int32_t ip4_address)
+{
+    struct trie_node *new_node = new_leaf(string, strlen, ip4_address);
+    if (!new_node)
+        return 0;
+    if (!_add_child(node, string[strlen - 1], new_node))
+    {
+        node_free(new_node);
+        return 0;
+    }
+    return 1;
+}
+
+/* Helper function. node's key has already been matched; file the
+ * remaining strlen chars of the string below it. Called with the
+ * mutex held.
+ */
+static int _insert (const char *string, size_t strlen, int32_t ip4_address,
+                    struct trie_node *node)
+{
+    size_t keylen;
+    
+    while (strlen > 0)
+    {
+        // no child ends like we do: insert leaf here
+        struct trie_node *child = children_find(node->children, string[strlen - 1]);
+        if (child == NULL)
+            return _add_leaf(node, string, strlen, ip4_address);
+        
+        assert (child->strlen <= NODE_MAX_KEY);
+        
+        // how much of the child's key do we share? at least the last char.
+        keylen = node_suffix(child, string, strlen);
+        if (keylen < child->strlen)
+        {
+            // Insert a common parent holding the shared suffix, and
+            //  go on from it (its only child is the old one, for now).
+            //  readers may be on the old one, so instead of shortening
+            //  its key in place it is replaced by a copy with the
+            //  shorter key, which takes over its children.
+            struct trie_node *new_node = new_leaf (&string[strlen - keylen], keylen, 0);
+            struct trie_node *head = new_leaf (node_text(child), child->strlen - keylen,
+                                               child->ip4_address);
+            if (!new_node || !head ||
+                !children_add(&new_node->children,
+                              node_char(child, child->strlen - keylen - 1), head))
             {
-                // Insert here
-                struct trie_node *new_node = new_leaf (string, strlen, ip4_address);
-                node->next = new_node;
-                return 1;
+                if (new_node)
+                    node_free(new_node);
+                if (head)
+                    node_free(head);
+                return 0;
             }
-            else
-            {   // No, recur right (the node's key is "greater" than  the search key)
-                return _insert(string, strlen, ip4_address, node->next, NULL, node);
-            }
-        }
-        else
-        {   // Insert here
-            struct trie_node *new_node = new_leaf (string, strlen, ip4_address);
-            new_node->next = node;
-            if (node == root)
-                root = new_node;
+            head->children = child->children;
+            children_set(node->children, string[strlen - 1], new_node);
+            _retire_node(child);
+            child = new_node;
         }
+        
+        strlen -= keylen;
+        node = child;
+    }
+    
+    // the name ends right here
+    if (node->ip4_address == 0)
+    {
+        __atomic_store_n(&node->ip4_address, ip4_address, __ATOMIC_RELAXED);
         return 1;
     }
+    return 0;
 }
 
+
+// local: applies a batch of writes for combine(), below.
+static void _combine(struct shard *shard, struct combine_request *list);
+
 int insert (const char *string, size_t strlen, int32_t ip4_address) {
   int ret=0;
   if (strlen==0)
         return ret; 
+  if (!key_encode(string, strlen))
+        return ret;
+
+  struct shard *shard = _shard(string, strlen);
+  if (!allow_squatting)
+  {
+      struct combine_request req = { COMBINE_INSERT, string, strlen, ip4_address };
+      DEBUG_PRINT("insert: %.*s\n", (int)strlen, string);
+      return combine(shard, &req, _combine);
+  }
 
-  pthread_rwlock_wrlock(&lock);
+  pthread_mutex_lock(&shard->mutex);
   
 
     if (allow_squatting)
@@ -319,158 +348,262 @@ int insert (const char *string, size_t strlen, int32_t ip4_address) {
         // so long as _search() continues to return the node, we need
         //  to wait until someone else removes it (and if no one else
         //  is around to do that, we're probably hung).
-        while(!finished && _search(root, string, strlen))
+        while(!finished && _search(&shard->root, string, strlen))
         {
             DEBUG_PRINT("waiting: %.*s\n", (int)strlen, string);
-            pthread_cond_wait(&condition, &mutex);
+            squatted = 1;
+            pthread_cond_wait(&shard->condition, &shard->mutex);
         }
 
         // leave *now* if shutting down
         if (finished)
         {
-            pthread_rwlock_unlock(&lock);
+            pthread_mutex_unlock(&shard->mutex);
             return 0l;
         }
     }
 
     DEBUG_PRINT("insert: %.*s\n", (int)strlen, string);
 
-  /* Edge case: root is null */
-    if (root == NULL)
+    // walk down the tree starting at root.
+    ret = _insert (string, strlen, ip4_address, &shard->root);
+    pthread_mutex_unlock(&shard->mutex);
+    return ret; 
+}
+
+/* Helper function. node's key has already been matched; delete the
+ * remaining strlen chars of the string below it. Returns 1 if the
+ * name was found. Called with the mutex held.
+ */
+static int _delete(struct trie_node *node, const char *string, size_t strlen)
+{
+    struct node_path path;
+    
+    // find the name, keeping track of the way down for the cleanup.
+    path.depth = 0;
+    while (strlen > 0)
     {
-        root = new_leaf(string, strlen, ip4_address);
-        if(root!=NULL)
-            ret =1;
+        // look for the only child that can match
+        struct trie_node *child = children_find(node->children, string[strlen - 1]);
+        if (child == NULL)
+            return 0;
+        
+        // See if its key is a tail-substring of the string passed in
+        if (node_suffix(child, string, strlen) != child->strlen)
+            return 0;
+        
+        assert (path.depth < NODE_MAX_DEPTH);
+        path.node[path.depth] = node;
+        path.ch[path.depth++] = string[strlen - 1];
+        strlen -= child->strlen;
+        node = child;
     }
-    else
-    {   // recurse into tree starting at root.
-        ret = _insert (string, strlen, ip4_address, root, NULL, NULL);
+    
+    // just an interior node, nothing is stored here.
+    if (node->ip4_address == 0)
+        return 0;
+    
+    // Success! clear the ip address. then walk back up: every node
+    //  this leaves as an interior with no children must be removed
+    //  from its parent's children and retired. out of memory leaves
+    //  it in place, empty, which does no harm.
+    __atomic_store_n(&node->ip4_address, 0, __ATOMIC_RELAXED);
+    while (path.depth > 0 && node->children == NULL && node->ip4_address == 0)
+    {
+        path.depth--;
+        if (!_remove_child(path.node[path.depth], path.ch[path.depth]))
+            break;
+        _retire_node(node);
+        node = path.node[path.depth];
     }
-    pthread_rwlock_unlock(&lock);
-    return ret; 
+    return 1;
 }
 
-/* Recursive helper function.
- * Returns a pointer to the node if found.
- * Stores an optional pointer to the 
- * parent, or what should be the parent if not found.
- * 
- */
+int delete  (const char *string, size_t strlen) {
 
+// Skip strings of length 0
+    int ret=0;
+    if (strlen==0)
+        return ret;
+    if (!key_encode(string, strlen))
+        return ret;
 
+    struct shard *shard = _shard(string, strlen);
+    if (!allow_squatting)
+    {
+        struct combine_request req = { COMBINE_DELETE, string, strlen };
+        DEBUG_PRINT("delete: %.*s\n", (int)strlen, string);
+        return combine(shard, &req, _combine);
+    }
 
+    pthread_mutex_lock(&shard->mutex);
 
-static struct trie_node* _delete(struct trie_node *node,
-                                 const char *string, size_t strlen)
+  DEBUG_PRINT("delete: %.*s\n", (int)strlen, string);
+
+    // the root itself is never freed.
+    ret = _delete(&shard->root, string, strlen);
+    if (ret)
+    {
+        DEBUG_PRINT("Root: %p\n", &shard->root);
+#ifdef DEBUG
+        _print(&shard->root,4);
+#endif
+    }
+
+    // release the mutex
+    pthread_mutex_unlock(&shard->mutex);
+
+    // then tell anyone that is listening we just deleted
+    //  an item from the tree (if we did, in fact do so)
+    if (ret && allow_squatting)
+        pthread_cond_broadcast(&shard->condition);
+
+    return ret;
+}
+
+// local: a batch of writes posted to combine(), applied in one go
+//  by whichever writer holds the shard's mutex.
+static void _combine(struct shard *shard, struct combine_request *list)
 {
-    if (node == NULL)
-        return NULL;
+    struct combine_request *req;
 
-    // See if this key is a tail-substring of the string passed in
-    size_t keylen = 0;
-    int cmp = compare_keys(node->key, node->strlen, string, strlen, &keylen);
-    if (cmp == 0)
+    for (req = list; req; req = req->next)
     {
-        // if the result-node key is longer than ours, we have to return NULL
-        if (node->strlen > keylen)
-            node = NULL;
+        // packed keys are encoded per thread (see keys.h): match each
+        //  request's name, not ours. it can't fail, its poster checked.
+        key_encode(req->string, req->strlen);
+        if (req->op == COMBINE_INSERT)
+            req->ret = _insert(req->string, req->strlen, req->ip4_address,
+                               &shard->root);
+        else
+            req->ret = _delete(&shard->root, req->string, req->strlen);
+    }
+#ifdef DEBUG
+    _print(&shard->root, 4);
+#endif
+}
 
-        // if there is still keydata left to consume, recurse to children.
-        else if (strlen > keylen)
+// local: build one shard's tree bottom-up from a sorted plan (see
+//  bulk.h) instead of walking it once per name. the shard is empty
+//  and its mutex held.
+static int _bulk_load(struct shard *shard, const char **keys, const size_t *lens,
+                      const int32_t *ips, size_t n)
+{
+    struct bulk_plan plan;
+    struct trie_node **nodes;
+    size_t i;
+    int stored = 0;
+
+    if (!bulk_plan_build(&plan, keys, lens, ips, n))
+        return 0;
+    nodes = malloc(plan.count * sizeof(*nodes) + 1);
+    for (i = 0; nodes && i < plan.count; ++i)
+    {
+        nodes[i] = new_leaf(plan.nodes[i].key, plan.nodes[i].strlen,
+                            plan.nodes[i].ip4_address);
+        if (!nodes[i])
         {
-            // look in children list for possible match
-            struct trie_node *found =  _delete(node->children, string, strlen - keylen);
-            if (found)
-            {
-                // match returned. 
-                if (found->children == NULL && found->ip4_address == 0)
-                {
-                    node->children = found->next;
-                    free(found);
-                }
-            }
-            else
-            {   // no match on children means no match at all. therefore
-                //  our return result must be NULL.
-                node = NULL;
-            }
-        }
-        else
-        {   // Success! clear the ip address. the caller is responsible for
-            // establishing whether to keep this based on child and sibling
-            // reference pointers.
-            node->ip4_address = 0;
+            while (i > 0)
+                node_free(nodes[--i]);
+            free(nodes);
+            nodes = NULL;
         }
     }
-    else if (cmp < 0)
+
+    if (nodes)
     {
-        // node is lesser. look to the node's sibling list.
-        struct trie_node *found = _delete(node->next, string, strlen);
-        if (found)
+        // each sibling list of the plan becomes a child container.
+        //  readers may already be looking at the root, so the whole
+        //  tree is built before it is published there.
+        struct children *top = NULL;
+        int ok = 1;
+        int64_t j;
+        for (i = 0; ok && i < plan.count; ++i)
+            for (j = plan.nodes[i].children; ok && j >= 0; j = plan.nodes[j].next)
+                ok = children_add(&nodes[i]->children, node_last(nodes[j]), nodes[j]);
+        for (j = plan.root; ok && j >= 0; j = plan.nodes[j].next)
+            ok = children_add(&top, node_last(nodes[j]), nodes[j]);
+        if (ok)
         {
-            // found a match. if this match is an interior with no children
-            //  we must remove it from our sibling list and free it.
-            if (found->children == NULL && found->ip4_address == 0)
+            __atomic_store_n(&shard->root.children, top, __ATOMIC_RELEASE);
+            stored = plan.records;
+        }
+        else
+        {
+            perror("Failed to allocate memory for bulk_load().\n");
+            for (i = 0; i < plan.count; ++i)
             {
-                node->next = found->next;
-free(found);
+                children_free(nodes[i]->children);
+                node_free(nodes[i]);
             }
+            children_free(top);
         }
-    }
-    else
-    {   // greater than the given key, so no match is possible.
-        node = NULL;
+        free(nodes);
     }
 
-    // return whatever node finally ended up being.
-    return node;
+    bulk_plan_free(&plan);
+    return stored;
 }
 
+// external facing bulk loader: splits the records between the shards
+//  and builds each shard's tree in one go. a shard that runs out of
+//  memory is left empty.
+int bulk_load(const char **keys, const size_t *lens, const int32_t *ips, size_t n)
+{
+    struct shard_records records;
+    size_t i;
+    unsigned s;
+    int stored = 0, empty = 1;
 
+    // every shard is locked for the whole load, always in order
+    for (s = 0; s < nshards; ++s)
+    {
+        pthread_mutex_lock(&shards[s].mutex);
+        empty = empty && shards[s].root.children == NULL;
+    }
 
+    // only an empty tree can be built in one go. otherwise fall back
+    //  to inserting the names one by one.
+    if (!empty)
+    {
+        for (s = 0; s < nshards; ++s)
+            pthread_mutex_unlock(&shards[s].mutex);
+        for (i = 0; i < n; ++i)
+            if (ips[i] && lens[i] <= BULK_MAX_KEY)
+                stored += insert(keys[i], lens[i], ips[i]);
+        return stored;
+    }
 
-
-
-
-
-int delete  (const char *string, size_t strlen) {
-
-// Skip strings of length 0
-    int ret=0;
-    if (strlen==0)
-        return ret;
-
-	// Skip strings of length 0
-	pthread_rwlock_wrlock(&lock);
-
-  DEBUG_PRINT("delete: %.*s\n", (int)strlen, string);
-
-    // this will return the node
-    struct trie_node* found = _delete(root, string, strlen);
-    if (found)
+    if (shard_split(&records, keys, lens, ips, n, nshards))
     {
-        // it is possible the root was the node returned. If it is,
-        //  it needs to be advanced to its sibling pointer (which may
-        //  be null) and free'd. but we do not free it if the node
-        //  has children.
-        if (found == root && found->children == NULL)
-        {
-            // ensure the IP address is 0 before removing this.
-            root = root->next;
-            free(found);
-        }
-        ret = 1;
-        DEBUG_PRINT("Root: %p\n", root);
-        _print(root,4);
+        for (s = 0; s < nshards; ++s)
+            stored += _bulk_load(&shards[s], records.keys + records.first[s],
+                                 records.lens + records.first[s],
+                                 records.ips + records.first[s],
+                                 records.first[s + 1] - records.first[s]);
+        shard_records_free(&records);
     }
 
-    // release the mutex
-    pthread_rwlock_unlock(&lock);
+    for (s = 0; s < nshards; ++s)
+        pthread_mutex_unlock(&shards[s].mutex);
+    return stored;
+}
 
-    // then tell anyone that is listening we just deleted
-    //  an item from the tree (if we did, in fact do so)
-    if (ret && allow_squatting)
-        pthread_cond_broadcast(&condition);
+// invoked by main() thread once every client has been joined. the
+//  nodes all live in the slabs, so they are released a chunk at a
+//  time rather than one free() per node.
+void destroy()
+{
+    unsigned s;
 
-    return ret;
+    for (s = 0; s < nshards; ++s)
+    {
+        pthread_mutex_lock(&shards[s].mutex);
+        shards[s].root.children = NULL;
+    }
+    epoch_destroy();
+    slab_destroy();
+    for (s = 0; s < nshards; ++s)
+        pthread_mutex_unlock(&shards[s].mutex);
 }
+//////////////////////////////////////////////////////////////////////
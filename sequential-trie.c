@@ -5,336 +5,390 @@
 #include <string.h>
 #include <stdlib.h>
 #include "trie.h"
+#include "bulk.h"
+#include "keys.h"
+#include "node.h"
+#include "replica.h"
+#include "shard.h"
+
+/* A root has an empty key and no address; names hang off its
+ * children.  See node.h.  There is one root, unless the tree is
+ * served by delegate_servers threads (see delegate.h): then it is
+ * split by zone into SHARD_MAX trees, so that no two servers ever
+ * touch the same one and none of them needs a lock. */
+static struct trie_node roots[SHARD_MAX];
+static unsigned nroots = 1;
+
+static struct trie_node *_root (const char *string, size_t strlen) {
+  return nroots == 1 ? &roots[0] : &roots[shard_of(string, strlen, nroots)];
+}
 
-struct trie_node {
-  struct trie_node *next;  /* parent list */
-  unsigned int strlen; /* Length of the key */
-  int32_t ip4_address; /* 4 octets */
-  struct trie_node *children; /* Sorted list of children */
-  char key[64]; /* Up to 64 chars */
-};
-
-static struct trie_node * root = NULL;
+/* With replicas (see replica.h), each one has a whole copy of the
+ * tree, under a root of its own here.  Writes reach the copies
+ * through the log, by way of _apply(). */
+static struct trie_node replica_roots[REPLICA_MAX];
+static int _apply (int r, const struct replica_entry *e);
 
 struct trie_node * new_leaf (const char *string, size_t strlen, int32_t ip4_address) {
-  struct trie_node *new_node = malloc(sizeof(struct trie_node));
+  struct trie_node *new_node = slab_alloc(sizeof(struct trie_node));
   if (!new_node) {
     printf ("WARNING: Node memory allocation failed.  Results may be bogus.\n");
     return NULL;
   }
-  assert(strlen < 64);
-  assert(strlen > 0);
-  new_node->next = NULL;
-  new_node->strlen = strlen;
-  strncpy(new_node->key, string, strlen);
-  new_node->key[strlen] = '\0';
+  if (!node_set_key(new_node, string, strlen)) {
+    slab_free(new_node);
+    printf ("WARNING: Node memory allocation failed.  Results may be bogus.\n");
+    return NULL;
+  }
   new_node->ip4_address = ip4_address;
+  new_node->lock = 0;
   new_node->children = NULL;
 
   return new_node;
 }
 
-int compare_keys (const char *string1, int len1, const char *string2, int len2, int *pKeylen) {
-    int keylen, offset1, offset2;
-    keylen = len1 < len2 ? len1 : len2;
-    offset1 = len1 - keylen;
-    offset2 = len2 - keylen;
-    assert (keylen > 0);
-    if (pKeylen)
-      *pKeylen = keylen;
-    return strncmp(&string1[offset1], &string2[offset2], keylen);
-}
-
 void init(int numthreads) {
-  if (numthreads != 1)
+  unsigned i;
+
+  if (numthreads != 1 && !delegate_servers && !replicas)
     printf("WARNING: This Trie is only safe to use with one thread!!!  You have %d!!!\n", numthreads);
 
-  root = NULL;
+  nroots = delegate_servers ? SHARD_MAX : 1;
+  for (i = 0; i < nroots; i++)
+    memset(&roots[i], 0, sizeof(roots[i]));
+
+  if (replicas) {
+    for (i = 0; i < (unsigned)replicas; i++)
+      memset(&replica_roots[i], 0, sizeof(replica_roots[i]));
+    if (!replica_init(replicas, _apply))
+      abort();
+  }
 }
 
-/* Recursive helper function.
- * Returns a pointer to the node if found.
- * Stores an optional pointer to the 
- * parent, or what should be the parent if not found.
- * 
+/* Helper function.
+ * node's key has been matched; look for the remaining strlen chars
+ * of string below it.  Returns a pointer to the node if found.
  */
 struct trie_node * 
 _search (struct trie_node *node, const char *string, size_t strlen) {
 	 
-  int keylen, cmp;
+  struct trie_node *child;
 
-  // First things first, check if we are NULL 
-  if (node == NULL) return NULL;
+  // Match one child per level until nothing is left
+  while (strlen > 0) {
+    // The only child that can match is the one ending in our last char
+    child = children_find(node->children, string[strlen - 1]);
+    if (child == NULL) return NULL;
 
-  assert(node->strlen < 64);
+    assert (child->strlen <= NODE_MAX_KEY);
 
-  // See if this key is a substring of the string passed in
-  cmp = compare_keys(node->key, node->strlen, string, strlen, &keylen);
-  if (cmp == 0) {
-    // Yes, either quit, or recur on the children
-
-    // If this key is longer than our search string, the key isn't here
-    if (node->strlen > keylen) {
+    // If its key isn't a suffix of our search string, the key isn't here
+    if (node_suffix(child, string, strlen) != child->strlen)
       return NULL;
-    } else if (strlen > keylen) {
-      // Recur on children list
-      return _search(node->children, string, strlen - keylen);
-    } else {
-      assert (strlen == keylen);
-
-      return node;
-    }
 
-  } else if (cmp < 0) {
-    // No, look right (the node's key is "less" than the search key)
-    return _search(node->next, string, strlen);
-  } else {
-    // Quit early
-    return 0;
+    strlen -= child->strlen;
+    node = child;
   }
 
+  // This is the one, if it has an address
+  return node->ip4_address ? node : NULL;
 }
 
 
 int search  (const char *string, size_t strlen, int32_t *ip4_address) {
-  struct trie_node *found;
+  struct trie_node *found, *root;
+  int r = 0, ret;
 
   // Skip strings of length 0
   if (strlen == 0)
     return 0;
 
-  found = _search(root, string, strlen);
+  // Bring our replica up to date first: that applies writes, which
+  // encode keys of their own
+  if (replicas) {
+    r = replica_self();
+    replica_read_begin(r);
+    root = &replica_roots[r];
+  } else {
+    root = _root(string, strlen);
+  }
+
+  found = key_encode(string, strlen) ? _search(root, string, strlen) : NULL;
   
   if (found && ip4_address)
     *ip4_address = found->ip4_address;
+  ret = (found != NULL);
 
-  return (found != NULL);
+  if (replicas)
+    replica_read_end(r);
+  return ret;
 }
 
-/* Recursive helper function */
+/* Helper function.  node's key has been matched; file the
+ * remaining strlen chars of string below it. */
 int _insert (const char *string, size_t strlen, int32_t ip4_address, 
-	     struct trie_node *node, struct trie_node *parent, struct trie_node *left) {
-
-  int cmp, keylen;
+	     struct trie_node *node) {
 
-  // First things first, check if we are NULL 
-  assert (node != NULL);
-  assert (node->strlen < 64);
-
-  // Take the minimum of the two lengths
-  cmp = compare_keys (node->key, node->strlen, string, strlen, &keylen);
-  if (cmp == 0) {
-    // Yes, either quit, or recur on the children
-
-    // If this key is longer than our search string, we need to insert
-    // "above" this node
-    if (node->strlen > keylen) {
-      struct trie_node *new_node;
-
-      assert(keylen == strlen);
-      assert((!parent) || parent->children == node);
+  struct trie_node *child, *new_node;
+  size_t keylen;
 
+  while (strlen > 0) {
+    child = children_find(node->children, string[strlen - 1]);
+    if (child == NULL) {
+      // No child ends like we do: insert leaf here
       new_node = new_leaf (string, strlen, ip4_address);
-      node->strlen -= keylen;
-      new_node->children = node;
-
-      assert ((!parent) || (!left));
-
-      if (parent) {
-	parent->children = new_node;
-      } else if (left) {
-	left->next = new_node;
-      } else if ((!parent) || (!left)) {
-	root = new_node;
+      if (!new_node)
+        return 0;
+      if (!children_add(&node->children, string[strlen - 1], new_node)) {
+        node_free(new_node);
+        return 0;
       }
       return 1;
-
-    } else if (strlen > keylen) {
-      
-      if (node->children == NULL) {
-	// Insert leaf here
-	struct trie_node *new_node = new_leaf (string, strlen - keylen, ip4_address);
-	node->children = new_node;
-	return 1;
-      } else {
-	// Recur on children list, store "parent" (loosely defined)
-      return _insert(string, strlen - keylen, ip4_address,
-		     node->children, node, NULL);
-      }
-    } else {
-      assert (strlen == keylen);
-      if (node->ip4_address == 0) {
-	node->ip4_address = ip4_address;
-	return 1;
-      } else {
-	return 0;
-      }
     }
 
-  } else {
-    /* Is there any common substring? */
-    int i, cmp2, keylen2, overlap = 0;
-    for (i = 1; i < keylen; i++) {
-      cmp2 = compare_keys (&node->key[i], node->strlen - i, 
-			   &string[i], strlen - i, &keylen2);
-      assert (keylen2 > 0);
-      if (cmp2 == 0) {
-	overlap = 1;
-	break;
+    assert (child->strlen <= NODE_MAX_KEY);
+
+    // How much of the child's key do we share?  At least the last char.
+    keylen = node_suffix(child, string, strlen);
+    if (keylen < child->strlen) {
+      // Insert a common parent holding the shared suffix, and go on
+      // from it (its only child is the old one, for now)
+      new_node = new_leaf (&string[strlen - keylen], keylen, 0);
+      if (!new_node)
+        return 0;
+      if (!children_add(&new_node->children,
+                        node_char(child, child->strlen - keylen - 1), child)) {
+        node_free(new_node);
+        return 0;
       }
+      node_shorten_key(child, child->strlen - keylen);
+      children_set(node->children, string[strlen - 1], new_node);
+      child = new_node;
     }
 
-    if (overlap) {
-      // Insert a common parent, recur
-      struct trie_node *new_node = new_leaf (&string[i], strlen - i, ip4_address);
-      int diff = node->strlen - i;
-      assert ((node->strlen - diff) > 0);
-      node->strlen -= diff;
-      new_node->children = node;
-      assert ((!parent) || (!left));
-
-      if (parent) {
-	parent->children = new_node;
-      } else if (left) {
-	left->next = new_node;
-      } else if ((!parent) && (!left)) {
-	root = new_node;
-      }
+    strlen -= keylen;
+    node = child;
+  }
 
-      return _insert(string, i, ip4_address,
-		     node, new_node, NULL);
-
-    } else if (cmp > 0) {
-      if (node->next == NULL) {
-	// Insert here
-	struct trie_node *new_node = new_leaf (string, strlen, ip4_address);
-	node->next = new_node;
-	return 1;
-      } else {
-	// No, recur right (the node's key is "greater" than  the search key)
-	return _insert(string, strlen, ip4_address, node->next, NULL, node);
-      }
-    } else {
-      // Insert here
-      struct trie_node *new_node = new_leaf (string, strlen, ip4_address);
-      node->next = new_node;
-      return 1;
-    }
+  // Nothing left: the name ends at this node
+  if (node->ip4_address == 0) {
+    node->ip4_address = ip4_address;
+    return 1;
   }
+  return 0;
 }
 
 int insert (const char *string, size_t strlen, int32_t ip4_address) {
   // Skip strings of length 0
   if (strlen == 0)
     return 0;
+  if (!key_encode(string, strlen))
+    return 0;
 
-  /* Edge case: root is null */
-  if (root == NULL) {
-    root = new_leaf (string, strlen, ip4_address);
-    return 1;
-  }
-  return _insert (string, strlen, ip4_address, root, NULL, NULL);
+  if (replicas)
+    return replica_write(replica_self(), REPLICA_INSERT, string, strlen, ip4_address);
+  return _insert (string, strlen, ip4_address, _root(string, strlen));
 }
 
-/* Recursive helper function.
- * Returns a pointer to the node if found.
- * Stores an optional pointer to the 
- * parent, or what should be the parent if not found.
- * 
+/* Helper function.
+ * node's key has been matched; delete the remaining strlen chars of
+ * string below it.  Returns 1 if the name was found.
  */
-struct trie_node * 
+int
 _delete (struct trie_node *node, const char *string, 
 	 size_t strlen) {
-  int keylen, offset1, offset2, cmp;
+  struct node_path path;
+  struct trie_node *child;
+
+  // Find the name, remembering the way down
+  path.depth = 0;
+  while (strlen > 0) {
+    child = children_find(node->children, string[strlen - 1]);
+    if (child == NULL) return 0;
+
+    assert (child->strlen <= NODE_MAX_KEY);
+
+    // If its key isn't a suffix of our search string, the key isn't here
+    if (node_suffix(child, string, strlen) != child->strlen)
+      return 0;
+
+    assert (path.depth < NODE_MAX_DEPTH);
+    path.node[path.depth] = node;
+    path.ch[path.depth++] = string[strlen - 1];
+    strlen -= child->strlen;
+    node = child;
+  }
 
-  // First things first, check if we are NULL 
-  if (node == NULL) return NULL;
+  /* Just an interior node with no value */
+  if (node->ip4_address == 0)
+    return 0;
 
-  assert(node->strlen < 64);
+  /* We found it!  Clear the ip4 address, then walk back up deleting
+   * the nodes this leaves with neither children nor an address.
+   * Otherwise, keep them around to find the kids */
+  node->ip4_address = 0;
+  while (path.depth > 0 && node->children == NULL && node->ip4_address == 0) {
+    path.depth--;
+    children_remove(&path.node[path.depth]->children, path.ch[path.depth]);
+    node_free(node);
+    node = path.node[path.depth];
+  }
+  return 1;
+}
 
-  // Take the minimum of the two lengths
-  keylen = node->strlen < strlen ? node->strlen : strlen;
-  offset1 = node->strlen - keylen;
-  offset2 = strlen - keylen;
+int delete  (const char *string, size_t strlen) {
+  // Skip strings of length 0
+  if (strlen == 0)
+    return 0;
+  if (!key_encode(string, strlen))
+    return 0;
 
-  // See if this key is a substring of the string passed in
-  cmp = strncmp(&node->key[offset1], &string[offset2], keylen);
-  if (cmp == 0) {
-    // Yes, either quit, or recur on the children
+  if (replicas)
+    return replica_write(replica_self(), REPLICA_DELETE, string, strlen, 0);
+  return _delete(_root(string, strlen), string, strlen);
+}
 
-    // If this key is longer than our search string, the key isn't here
-    if (node->strlen > keylen) {
-      return NULL;
-    } else if (strlen > keylen) {
-      struct trie_node *found =  _delete(node->children, string, strlen - keylen);
-      if (found) {
-	/* If the node doesn't have children, delete it.
-	 * Otherwise, keep it around to find the kids */
-        if (found->children == NULL && found->ip4_address == 0) {
-          if (node->next == found)
-            node->next = found->next;
-          else
-            node->children = found->next;
-	  free(found);
-	}
-	return node; /* Recursively delete needless interior nodes */
-      } else 
-	return NULL;
-    } else {
-      assert (strlen == keylen);
-
-      /* We found it! Clear the ip4 address and return. */
-      if (node->ip4_address) {
-	node->ip4_address = 0;
-	return node;
-      } else {
-	/* Just an interior node with no value */
-	return NULL;
-      }
-    }
+/* Apply a write from the log to replica r's copy of the tree */
+static int _apply (int r, const struct replica_entry *e) {
+  if (!key_encode(e->string, e->strlen))
+    return 0;
+  if (e->op == REPLICA_INSERT)
+    return _insert (e->string, e->strlen, e->ip4_address, &replica_roots[r]);
+  return _delete(&replica_roots[r], e->string, e->strlen);
+}
 
-  } else if (cmp < 0) {
-    // No, look right (the node's key is "less" than  the search key)
-    struct trie_node *found = _delete(node->next, string, strlen);
-    if (found) {
-      /* If the node doesn't have children, delete it.
-       * Otherwise, keep it around to find the kids */
-      if (found->children == NULL && found->ip4_address == 0) {
-        if (node->next == found)
-          node->next = found->next;
-        else
-          node->children = found->next;
-	free(found);
-      }
-      return node; /* Recursively delete needless interior nodes */
+/* Build one root's (empty) tree bottom-up from a sorted plan; see
+ * bulk.h */
+static int _bulk_load (struct trie_node *root, const char **keys, const size_t *lens,
+                       const int32_t *ips, size_t n) {
+  struct bulk_plan plan;
+  struct trie_node **nodes;
+  int64_t j;
+  size_t i;
+  int stored = 0, ok = 1;
+
+  if (!bulk_plan_build (&plan, keys, lens, ips, n))
+    return 0;
+  nodes = malloc (plan.count * sizeof(*nodes) + 1);
+  for (i = 0; nodes && i < plan.count; i++) {
+    nodes[i] = new_leaf (plan.nodes[i].key, plan.nodes[i].strlen,
+                         plan.nodes[i].ip4_address);
+    if (!nodes[i]) {
+      while (i > 0)
+        node_free (nodes[--i]);
+      free (nodes);
+      nodes = NULL;
     }
-    return NULL;
+  }
+  if (!nodes) {
+    bulk_plan_free (&plan);
+    return 0;
+  }
+
+  /* Each sibling list of the plan becomes a child container */
+  for (i = 0; ok && i < plan.count; i++)
+    for (j = plan.nodes[i].children; ok && j >= 0; j = plan.nodes[j].next)
+      ok = children_add (&nodes[i]->children, node_last(nodes[j]), nodes[j]);
+  for (j = plan.root; ok && j >= 0; j = plan.nodes[j].next)
+    ok = children_add (&root->children, node_last(nodes[j]), nodes[j]);
+  if (ok) {
+    stored = plan.records;
   } else {
-    // Quit early
-    return NULL;
+    printf ("WARNING: Bulk load ran out of memory.  Nothing was loaded.\n");
+    for (i = 0; i < plan.count; i++) {
+      children_free (nodes[i]->children);
+      node_free (nodes[i]);
+    }
+    children_free (root->children);
+    root->children = NULL;
   }
 
+  free (nodes);
+  bulk_plan_free (&plan);
+  return stored;
 }
 
-int delete  (const char *string, size_t strlen) {
-  // Skip strings of length 0
-  if (strlen == 0)
+/* A tree that isn't empty gets the records one by one */
+static int _insert_all (const char **keys, const size_t *lens, const int32_t *ips,
+                        size_t n) {
+  size_t i;
+  int stored = 0;
+
+  for (i = 0; i < n; i++)
+    if (ips[i] && lens[i] <= BULK_MAX_KEY)
+      stored += insert (keys[i], lens[i], ips[i]);
+  return stored;
+}
+
+int bulk_load (const char **keys, const size_t *lens, const int32_t *ips, size_t n) {
+  struct shard_records records;
+  unsigned r;
+  int stored = 0;
+
+  /* Every replica gets a copy of its own, once they have caught up */
+  if (replicas) {
+    replica_sync();
+    for (r = 0; r < (unsigned)replicas; r++)
+      if (replica_roots[r].children != NULL)
+        return _insert_all (keys, lens, ips, n);
+    for (r = 0; r < (unsigned)replicas; r++)
+      stored = _bulk_load (&replica_roots[r], keys, lens, ips, n);
+    return stored;
+  }
+
+  /* Only an empty tree can be built in one go */
+  for (r = 0; r < nroots; r++)
+    if (roots[r].children != NULL)
+      return _insert_all (keys, lens, ips, n);
+
+  if (nroots == 1)
+    return _bulk_load (&roots[0], keys, lens, ips, n);
+
+  /* Split by zone, a tree per root */
+  if (!shard_split (&records, keys, lens, ips, n, nroots))
     return 0;
+  for (r = 0; r < nroots; r++)
+    stored += _bulk_load (&roots[r], records.keys + records.first[r],
+                          records.lens + records.first[r],
+                          records.ips + records.first[r],
+                          records.first[r + 1] - records.first[r]);
+  shard_records_free (&records);
+  return stored;
+}
 
-  return (NULL != _delete(root, string, strlen));
+/* Free the whole tree at once: its nodes are all in the slabs */
+void destroy() {
+  unsigned r;
+
+  for (r = 0; r < nroots; r++)
+    roots[r].children = NULL;
+  for (r = 0; r < (unsigned)replicas; r++)
+    replica_roots[r].children = NULL;
+  if (replicas)
+    replica_destroy();
+  slab_destroy();
 }
 
 
 void _print (struct trie_node *node) {
-  printf ("Node at %p.  Key %.*s, IP %d.  Next %p, Children %p\n", 
-	  node, node->strlen, node->key, node->ip4_address, node->next, node->children);
-  if (node->children)
-    _print(node->children);
-  if (node->next)
-    _print(node->next);
+  struct trie_node *child;
+  int pos = 0;
+
+  printf ("Node at %p.  Key %.*s, IP %d.  Children %p\n", 
+	  node, node->strlen, node_text(node), node->ip4_address, node->children);
+  while ((child = children_next(node->children, &pos)))
+    _print(child);
 }
 
 void print() {
+  unsigned r;
+
   /* Do a simple depth-first search */
-  _print(root);
+  if (replicas) {
+    replica_sync();
+    _print(&replica_roots[0]);
+    return;
+  }
+  for (r = 0; r < nroots; r++)
+    _print(&roots[r]);
 }
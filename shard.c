@@ -0,0 +1,64 @@
+/* Splitting bulk loads between shards. */
+#include "shard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int shard_split(struct shard_records *records, const char **keys,
+                const size_t *lens, const int32_t *ips, size_t n,
+                unsigned nshards)
+{
+    unsigned *shard = malloc(n * sizeof(*shard) + 1);
+    size_t i, *next;
+    unsigned s;
+
+    records->keys = malloc(n * sizeof(*records->keys) + 1);
+    records->lens = malloc(n * sizeof(*records->lens) + 1);
+    records->ips = malloc(n * sizeof(*records->ips) + 1);
+    records->first = calloc(nshards + 1, sizeof(*records->first));
+    next = malloc(nshards * sizeof(*next));
+    if (!shard || !records->keys || !records->lens || !records->ips ||
+        !records->first || !next)
+    {
+        fprintf(stderr, "Failed to allocate memory for shard_split().\n");
+        free(shard);
+        free(next);
+        shard_records_free(records);
+        return 0;
+    }
+
+    // a counting sort, which keeps each shard's records in order
+    for (i = 0; i < n; ++i)
+    {
+        shard[i] = shard_of(keys[i], lens[i], nshards);
+        ++records->first[shard[i] + 1];
+    }
+    for (s = 0; s < nshards; ++s)
+    {
+        records->first[s + 1] += records->first[s];
+        next[s] = records->first[s];
+    }
+    for (i = 0; i < n; ++i)
+    {
+        size_t at = next[shard[i]]++;
+        records->keys[at] = keys[i];
+        records->lens[at] = lens[i];
+        records->ips[at] = ips[i];
+    }
+
+    free(shard);
+    free(next);
+    return 1;
+}
+
+void shard_records_free(struct shard_records *records)
+{
+    free(records->keys);
+    free(records->lens);
+    free(records->ips);
+    free(records->first);
+    records->keys = NULL;
+    records->lens = NULL;
+    records->ips = NULL;
+    records->first = NULL;
+}
@@ -0,0 +1,82 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "node.h"
+
+/* Sharding for the variants that lock the whole tree at once.
+ *
+ * Names are spread over a number of independent tries, each with its
+ * own lock, condition variable and root, so that writers to one only
+ * contend with writers to the same one.  A name goes to the shard its
+ * zone hashes to: its last two labels ("example.com" for
+ * "www.example.com"), or its last SHARD_KEY chars if those are longer.
+ * Every name of a zone so lives in the same shard.  Sharding by the
+ * last label alone would put nearly everything under "com".
+ *
+ * init() picks the number of shards, a power of two, from the number
+ * of threads.
+ */
+
+#define SHARD_MAX 256
+#define SHARD_PER_THREAD 4
+#define SHARD_KEY 32
+
+struct combine_request;
+
+struct shard {
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    struct trie_node root;      /* empty key, never freed */
+    unsigned seq;               /* odd while a writer is in; mutex-trie */
+    struct combine_request *pending;    /* posted writes, see combine.h */
+} __attribute__((aligned(SLAB_LINE)));
+
+static inline unsigned shard_count(int numthreads)
+{
+    unsigned n = 1;
+
+    while (n < SHARD_MAX && n < (unsigned)numthreads * SHARD_PER_THREAD)
+        n *= 2;
+    return n;
+}
+
+/* Which of nshards (a power of two) the name goes to. */
+static inline unsigned shard_of(const char *string, size_t strlen, unsigned nshards)
+{
+    uint32_t hash = 2166136261u;    // FNV-1a
+    size_t start = strlen;
+    int dots = 0;
+
+    while (start > 0 && strlen - start < SHARD_KEY)
+    {
+        if (string[start - 1] == '.' && ++dots == 2)
+            break;
+        --start;
+    }
+    for (; start < strlen; ++start)
+        hash = (hash ^ (unsigned char)string[start]) * 16777619u;
+    return hash & (nshards - 1);
+}
+
+/* Records reordered by shard, those of shard s at [first[s],
+ * first[s + 1]), each shard's in their original order.  For bulk
+ * loads, which build each shard's tree from its own records.
+ */
+struct shard_records {
+    const char **keys;
+    size_t *lens;
+    int32_t *ips;
+    size_t *first;              /* nshards + 1 of them */
+};
+
+/* Returns 0 and prints a message if out of memory. */
+int shard_split(struct shard_records *records, const char **keys,
+                const size_t *lens, const int32_t *ips, size_t n,
+                unsigned nshards);
+void shard_records_free(struct shard_records *records);
+
+#endif /* __SHARD_H__ */
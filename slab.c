@@ -0,0 +1,424 @@
+/* Size-class slab allocator for trie nodes. */
+#include "slab.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+int slab_huge_pages = 0;
+
+// header at the start of every chunk; the objects follow it, so they
+//  start on a cache line too.
+struct slab_chunk {
+    struct slab_chunk *next;    /* chunks of the same class */
+    uint32_t cls;
+    uint32_t huge;              /* backed by MAP_HUGETLB pages */
+} __attribute__((aligned(SLAB_LINE)));
+
+// a magazine is a small stack of free objects of one class. each
+//  thread holds two per class, so that alternating allocs and frees
+//  around a magazine boundary don't go to the depot every time.
+struct slab_magazine {
+    struct slab_magazine *next; /* depot list */
+    int rounds;                 /* # objects held */
+    void *obj[SLAB_MAG_ROUNDS];
+};
+
+// one per size class, each on its own lines so that allocating from
+//  one class doesn't bounce another class's lock around.  the lock
+//  also covers the depot: full magazines waiting for a thread that
+//  runs dry and empty ones for a thread whose magazines are full.
+struct slab_class {
+    pthread_mutex_t lock;
+    void *free;                 /* freed objects, linked through word 0 */
+    char *bump, *end;           /* unused tail of the newest chunk */
+    struct slab_chunk *chunks;
+    uint64_t nchunks, nhuge;
+    uint64_t in_use, peak;      /* out of the slab, tree or magazine */
+    struct slab_magazine *full, *empty;
+    uint64_t depot_rounds;      /* # objects in full magazines */
+    uint64_t hits, misses;      /* of threads that have exited */
+} __attribute__((aligned(SLAB_LINE)));
+
+static struct slab_class classes[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+// per-thread magazines, created on a thread's first allocation and
+//  handed back to the depot when the thread exits.
+struct slab_cache {
+    struct slab_magazine *loaded[SLAB_CLASSES];
+    struct slab_magazine *previous[SLAB_CLASSES];
+    uint64_t hits[SLAB_CLASSES];    /* allocs served from a magazine */
+    uint64_t misses[SLAB_CLASSES];  /* allocs that went to the slab */
+    struct slab_cache *next, *prev; /* all live caches, for reporting */
+};
+
+static __thread struct slab_cache *my_cache = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slab_cache *caches = NULL;
+
+// map a SLAB_CHUNK-aligned chunk.  explicit huge pages come aligned;
+//  otherwise map twice the size and trim both ends.
+static struct slab_chunk *map_chunk(int *huge)
+{
+    char *p, *aligned;
+
+    *huge = 0;
+    if (slab_huge_pages)
+    {
+        p = mmap(NULL, SLAB_CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            *huge = 1;
+            return (struct slab_chunk *)p;
+        }
+    }
+
+    p = mmap(NULL, 2 * SLAB_CHUNK, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    aligned = (char *)(((uintptr_t)p + SLAB_CHUNK - 1) & ~(SLAB_CHUNK - 1));
+    if (aligned > p)
+        munmap(p, aligned - p);
+    munmap(aligned + SLAB_CHUNK, p + SLAB_CHUNK - aligned);
+    if (slab_huge_pages)
+        madvise(aligned, SLAB_CHUNK, MADV_HUGEPAGE);
+    return (struct slab_chunk *)aligned;
+}
+
+// take one object from the class's free list or its newest chunk.
+//  called with the class lock held.
+static void *class_alloc(struct slab_class *c, int cls)
+{
+    size_t objsize = (cls + 1) * SLAB_LINE;
+    void *p;
+
+    if (c->free)
+    {
+        p = c->free;
+        c->free = *(void **)p;
+    }
+    else
+    {
+        if (c->bump + objsize > c->end)
+        {
+            int huge;
+            struct slab_chunk *chunk = map_chunk(&huge);
+            if (!chunk)
+                return NULL;
+            chunk->next = c->chunks;
+            chunk->cls = cls;
+            chunk->huge = huge;
+            c->chunks = chunk;
+            c->nchunks++;
+            c->nhuge += huge;
+            c->bump = (char *)(chunk + 1);
+            c->end = (char *)chunk + SLAB_CHUNK;
+        }
+        p = c->bump;
+        c->bump += objsize;
+    }
+    if (++c->in_use > c->peak)
+        c->peak = c->in_use;
+    return p;
+}
+
+// called with the class lock held.
+static void class_free(struct slab_class *c, void *p)
+{
+    *(void **)p = c->free;
+    c->free = p;
+    c->in_use--;
+}
+
+static inline int class_of(void *p)
+{
+    struct slab_chunk *chunk = (struct slab_chunk *)((uintptr_t)p & ~(SLAB_CHUNK - 1));
+    assert(chunk->cls < SLAB_CLASSES);
+    return chunk->cls;
+}
+
+// thread exit: full magazines go to the depot as they are, anything
+//  else goes back on the free list so the depot only holds full ones.
+static void flush_cache(void *arg)
+{
+    struct slab_cache *cache = arg;
+    int cls, i;
+
+    for (cls = 0; cls < SLAB_CLASSES; ++cls)
+    {
+        struct slab_class *c = &classes[cls];
+        struct slab_magazine *mags[2] = { cache->loaded[cls], cache->previous[cls] };
+
+        pthread_mutex_lock(&c->lock);
+        for (i = 0; i < 2; ++i)
+        {
+            struct slab_magazine *m = mags[i];
+            if (m->rounds == SLAB_MAG_ROUNDS)
+            {
+                m->next = c->full;
+                c->full = m;
+                c->depot_rounds += m->rounds;
+                continue;
+            }
+            while (m->rounds > 0)
+                class_free(c, m->obj[--m->rounds]);
+            m->next = c->empty;
+            c->empty = m;
+        }
+        c->hits += cache->hits[cls];
+        c->misses += cache->misses[cls];
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    pthread_mutex_lock(&caches_lock);
+    if (cache->prev)
+        cache->prev->next = cache->next;
+    else
+        caches = cache->next;
+    if (cache->next)
+        cache->next->prev = cache->prev;
+    pthread_mutex_unlock(&caches_lock);
+    free(cache);
+    my_cache = NULL;
+}
+
+static void make_cache_key(void)
+{
+    pthread_key_create(&cache_key, flush_cache);
+}
+
+// this thread's magazines, or NULL if they couldn't be allocated, in
+//  which case every call goes straight to the slab.
+static struct slab_cache *get_cache(void)
+{
+    struct slab_cache *cache = my_cache;
+    int cls;
+
+    if (cache)
+        return cache;
+    pthread_once(&cache_once, make_cache_key);
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+    for (cls = 0; cls < SLAB_CLASSES; ++cls)
+    {
+        cache->loaded[cls] = calloc(1, sizeof(struct slab_magazine));
+        cache->previous[cls] = calloc(1, sizeof(struct slab_magazine));
+        if (!cache->loaded[cls] || !cache->previous[cls])
+        {
+            for (; cls >= 0; --cls)
+            {
+                free(cache->loaded[cls]);
+                free(cache->previous[cls]);
+            }
+            free(cache);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&caches_lock);
+    cache->next = caches;
+    if (caches)
+        caches->prev = cache;
+    caches = cache;
+    pthread_mutex_unlock(&caches_lock);
+    pthread_setspecific(cache_key, cache);
+    my_cache = cache;
+    return cache;
+}
+
+void *slab_alloc(size_t size)
+{
+    struct slab_cache *cache = get_cache();
+    struct slab_class *c;
+    int cls = (size + SLAB_LINE - 1) / SLAB_LINE - 1;
+    void *p;
+
+    assert(size > 0 && size <= SLAB_MAX_SIZE);
+    c = &classes[cls];
+    if (cache)
+    {
+        struct slab_magazine *m = cache->loaded[cls];
+
+        // most recently freed first: it is the likeliest to be cached
+        if (m->rounds == 0 && cache->previous[cls]->rounds > 0)
+        {
+            cache->loaded[cls] = cache->previous[cls];
+            cache->previous[cls] = m;
+            m = cache->loaded[cls];
+        }
+        if (m->rounds > 0)
+        {
+            cache->hits[cls]++;
+            return m->obj[--m->rounds];
+        }
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (cache && c->full)
+    {
+        // both magazines are empty: trade one for a full one
+        struct slab_magazine *full = c->full;
+        c->full = full->next;
+        c->depot_rounds -= full->rounds;
+        cache->previous[cls]->next = c->empty;
+        c->empty = cache->previous[cls];
+        pthread_mutex_unlock(&c->lock);
+
+        cache->previous[cls] = cache->loaded[cls];
+        cache->loaded[cls] = full;
+        cache->hits[cls]++;
+        return full->obj[--full->rounds];
+    }
+    p = class_alloc(c, cls);
+    pthread_mutex_unlock(&c->lock);
+    if (cache)
+        cache->misses[cls]++;
+    return p;
+}
+
+void slab_free(void *p)
+{
+    struct slab_cache *cache;
+    struct slab_class *c;
+    int cls;
+
+    if (!p)
+        return;
+    cls = class_of(p);
+    c = &classes[cls];
+    cache = get_cache();
+    if (cache)
+    {
+        struct slab_magazine *m = cache->loaded[cls], *empty;
+
+        if (m->rounds == SLAB_MAG_ROUNDS && cache->previous[cls]->rounds == 0)
+        {
+            cache->loaded[cls] = cache->previous[cls];
+            cache->previous[cls] = m;
+            m = cache->loaded[cls];
+        }
+        if (m->rounds < SLAB_MAG_ROUNDS)
+        {
+            m->obj[m->rounds++] = p;
+            return;
+        }
+
+        // both magazines are full: hand one to the depot for a thread
+        //  that is allocating, and carry on with an empty one.
+        pthread_mutex_lock(&c->lock);
+        empty = c->empty;
+        if (empty)
+            c->empty = empty->next;
+        else
+            empty = calloc(1, sizeof(*empty));
+        if (empty)
+        {
+            cache->previous[cls]->next = c->full;
+            c->full = cache->previous[cls];
+            c->depot_rounds += SLAB_MAG_ROUNDS;
+            pthread_mutex_unlock(&c->lock);
+
+            cache->previous[cls] = m;
+            cache->loaded[cls] = empty;
+            empty->obj[empty->rounds++] = p;
+            return;
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    class_free(c, p);
+    pthread_mutex_unlock(&c->lock);
+}
+
+void slab_destroy(void)
+{
+    struct slab_cache *cache;
+    int cls;
+
+    // the objects still held by live threads are about to go away
+    pthread_mutex_lock(&caches_lock);
+    for (cache = caches; cache; cache = cache->next)
+        for (cls = 0; cls < SLAB_CLASSES; ++cls)
+            cache->loaded[cls]->rounds = cache->previous[cls]->rounds = 0;
+    pthread_mutex_unlock(&caches_lock);
+
+    for (cls = 0; cls < SLAB_CLASSES; ++cls)
+    {
+        struct slab_class *c = &classes[cls];
+        struct slab_chunk *chunk, *next;
+        struct slab_magazine *m, *mnext;
+
+        pthread_mutex_lock(&c->lock);
+        for (chunk = c->chunks; chunk; chunk = next)
+        {
+            next = chunk->next;
+            munmap(chunk, SLAB_CHUNK);
+        }
+        for (m = c->full; m; m = mnext)
+        {
+            mnext = m->next;
+            free(m);
+        }
+        for (m = c->empty; m; m = mnext)
+        {
+            mnext = m->next;
+            free(m);
+        }
+        c->free = NULL;
+        c->bump = c->end = NULL;
+        c->chunks = NULL;
+        c->full = c->empty = NULL;
+        c->nchunks = c->nhuge = c->in_use = c->depot_rounds = 0;
+        pthread_mutex_unlock(&c->lock);
+    }
+}
+
+void slab_report(void)
+{
+    struct slab_cache *cache;
+    int cls;
+
+    printf("\n  Node slabs:\n");
+    printf("  %6s %8s %8s %12s %10s %12s %10s %8s\n", "size", "chunks",
+           "huge", "in use", "cached", "peak", "occupancy", "mag hit");
+    pthread_mutex_lock(&caches_lock);
+    for (cls = 0; cls < SLAB_CLASSES; ++cls)
+    {
+        struct slab_class *c = &classes[cls];
+        uint64_t capacity, cached, hits, misses;
+
+        pthread_mutex_lock(&c->lock);
+        cached = c->depot_rounds;
+        hits = c->hits;
+        misses = c->misses;
+        for (cache = caches; cache; cache = cache->next)
+        {
+            cached += cache->loaded[cls]->rounds + cache->previous[cls]->rounds;
+            hits += cache->hits[cls];
+            misses += cache->misses[cls];
+        }
+        capacity = c->nchunks * ((SLAB_CHUNK - sizeof(struct slab_chunk)) /
+                                 ((cls + 1) * SLAB_LINE));
+        if (c->nchunks)
+            printf("  %6d %8llu %8llu %12llu %10llu %12llu %9.1f%% %7.1f%%\n",
+                   (cls + 1) * SLAB_LINE, (unsigned long long)c->nchunks,
+                   (unsigned long long)c->nhuge,
+                   (unsigned long long)(c->in_use - cached),
+                   (unsigned long long)cached, (unsigned long long)c->peak,
+                   100.0 * (c->in_use - cached) / capacity,
+                   hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+        pthread_mutex_unlock(&c->lock);
+    }
+    pthread_mutex_unlock(&caches_lock);
+}
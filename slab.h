@@ -0,0 +1,60 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Slab allocator for trie nodes, their long keys and their child
+ * containers (see children.h).
+ *
+ * Nodes are carved out of 2 MB chunks, one size class per multiple of
+ * a cache line up to SLAB_MAX_SIZE, so every node starts on its own
+ * line and nodes of one variant are packed together instead of being
+ * spread over the heap.  Each chunk is aligned to its size and starts
+ * with a header naming its class, which is how slab_free() finds the
+ * class without being told the size.  Freed nodes go on a per-class
+ * free list and are handed out again before the chunk is bumped.
+ *
+ * Chunks are only returned by slab_destroy(), which drops the whole
+ * tree in one pass over the chunk lists instead of one free() per node.
+ *
+ * In front of the slabs every thread keeps two magazines per class:
+ * small stacks of nodes it freed, which its next allocations pop
+ * without taking any lock, so a delete followed by an insert reuses
+ * the node that is still hot in this core's cache.  Threads that free
+ * more than they allocate pass full magazines to a per-class depot,
+ * and threads that run dry take them from there.
+ *
+ * slab_free() makes a node reusable at once, by this thread or, via
+ * the depot, by any other.  Callers must only free a node once no
+ * other thread can still be looking at it: after unlinking it under
+ * a lock that every traversal also holds, or after a grace period.
+ */
+
+#define SLAB_LINE 64
+#define SLAB_CHUNK (2UL << 20)
+#define SLAB_CLASSES 33           /* up to the largest child container */
+#define SLAB_MAX_SIZE (SLAB_CLASSES * SLAB_LINE)
+#define SLAB_MAG_ROUNDS 32
+
+/* Ask for explicit huge pages (MAP_HUGETLB) for new chunks, falling
+ * back to transparent huge pages if none are reserved.  Set before the
+ * first allocation.
+ */
+extern int slab_huge_pages;
+
+/* Returns a cache-line-aligned block of at least size bytes, or NULL
+ * when out of memory.  Thread-safe.
+ */
+void *slab_alloc(size_t size);
+void slab_free(void *p);
+
+/* Unmap every chunk.  Nothing allocated may be used afterwards. */
+void slab_destroy(void);
+
+/* Per-class chunk count, nodes in use and cached in magazines,
+ * occupancy and magazine hit rate, on stdout.
+ */
+void slab_report(void);
+
+#endif /* __SLAB_H__ */
@@ -0,0 +1,227 @@
+/* Throughput accounting for the simulator clients. */
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct client_stats *slots = NULL;
+static int nslots = 0;
+
+// wall-clock bookkeeping for the time series and the final report
+static struct timespec start_time, last_time, stop_time;
+static uint64_t last_total[STAT_NCOUNTERS], last_ops;
+static int tick_count = 0;
+
+static const char *counter_names[STAT_NCOUNTERS] = {
+    "search-hit", "search-miss",
+    "insert-ok", "insert-dup",
+    "delete-ok", "delete-absent",
+};
+
+static const char *op_names[OP_NTYPES] = {
+    "search", "insert", "delete", "squat",
+};
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// sum of all counters in a slot, read racily but tear-free.
+static uint64_t slot_total(struct client_stats *stats, uint64_t *out)
+{
+    uint64_t total = 0;
+    int c;
+    for (c = 0; c < STAT_NCOUNTERS; ++c)
+    {
+        uint64_t v = __atomic_load_n(&stats->count[c], __ATOMIC_RELAXED);
+        if (out)
+            out[c] += v;
+        total += v;
+    }
+    return total;
+}
+
+void stats_init(int numthreads)
+{
+    // aligned_alloc keeps every slot on its own cache line
+    slots = aligned_alloc(sizeof(struct client_stats),
+                          numthreads * sizeof(struct client_stats));
+    if (!slots)
+    {
+        perror("Failed to allocate client statistics");
+        exit(1);
+    }
+    memset(slots, 0, numthreads * sizeof(struct client_stats));
+    nslots = numthreads;
+}
+
+struct client_stats *stats_slot(int id)
+{
+    return &slots[id];
+}
+
+void stats_start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    last_time = start_time;
+    memset(last_total, 0, sizeof(last_total));
+    last_ops = 0;
+}
+
+void stats_stop(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &stop_time);
+}
+
+void stats_stop_at(uint64_t ns)
+{
+    stop_time.tv_sec = ns / 1000000000ull;
+    stop_time.tv_nsec = ns % 1000000000ull;
+}
+
+uint64_t stats_total_ops(void)
+{
+    uint64_t ops = 0;
+    int i;
+    for (i = 0; i < nslots; ++i)
+        ops += slot_total(&slots[i], NULL);
+    return ops;
+}
+
+double stats_elapsed(void)
+{
+    return elapsed(&start_time, &stop_time);
+}
+
+void stats_tick(void)
+{
+    uint64_t now_total[STAT_NCOUNTERS] = {0};
+    uint64_t ops = 0;
+    struct timespec now;
+    double dt;
+    int i, c;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < nslots; ++i)
+        ops += slot_total(&slots[i], now_total);
+
+    dt = elapsed(&last_time, &now);
+    printf("[%4d s] %10.0f ops/s", ++tick_count,
+           dt > 0 ? (ops - last_ops) / dt : 0.0);
+    for (c = 0; c < STAT_NCOUNTERS; ++c)
+        printf("  %s %llu", counter_names[c],
+               (unsigned long long)(now_total[c] - last_total[c]));
+    printf("\n");
+    fflush(stdout);
+
+    memcpy(last_total, now_total, sizeof(last_total));
+    last_ops = ops;
+    last_time = now;
+}
+
+// largest value that falls into bucket b.
+static uint64_t hist_bucket_high(unsigned b)
+{
+    unsigned shift;
+    if (b < HIST_SUB_COUNT)
+        return b;
+    shift = (b >> HIST_SUB_BITS) - 1;
+    return ((((uint64_t)(b & (HIST_SUB_COUNT - 1)) | HIST_SUB_COUNT) + 1) << shift) - 1;
+}
+
+// value at quantile q (0..1), reported as the top of its bucket but
+//  never above the exact maximum we observed.
+static uint64_t hist_quantile(const struct latency_hist *hist, double q)
+{
+    uint64_t rank, seen = 0;
+    unsigned b;
+
+    if (hist->count == 0)
+        return 0;
+    rank = (uint64_t)(q * hist->count);
+    if (rank >= hist->count)
+        rank = hist->count - 1;
+    for (b = 0; b < HIST_BUCKETS; ++b)
+    {
+        seen += hist->bucket[b];
+        if (seen > rank)
+        {
+            uint64_t v = hist_bucket_high(b);
+            return v < hist->max ? v : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static void hist_merge(struct latency_hist *into, const struct latency_hist *from)
+{
+    unsigned b;
+    for (b = 0; b < HIST_BUCKETS; ++b)
+        into->bucket[b] += from->bucket[b];
+    into->count += from->count;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+static void report_latency(void)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    struct latency_hist *merged;
+    int i, op;
+    unsigned q;
+
+    merged = calloc(1, sizeof(*merged));
+    if (!merged)
+        return;
+
+    printf("\n  Latency (ns):\n");
+    printf("  %8s %12s %10s %10s %10s %10s %12s\n",
+           "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (op = 0; op < OP_NTYPES; ++op)
+    {
+        memset(merged, 0, sizeof(*merged));
+        for (i = 0; i < nslots; ++i)
+            hist_merge(merged, &slots[i].latency[op]);
+        if (merged->count == 0 && op == OP_SQUAT)
+            continue;
+
+        printf("  %8s %12llu", op_names[op], (unsigned long long)merged->count);
+        for (q = 0; q < sizeof(quantiles)/sizeof(quantiles[0]); ++q)
+            printf(" %10llu", (unsigned long long)hist_quantile(merged, quantiles[q]));
+        printf(" %12llu\n", (unsigned long long)merged->max);
+    }
+    free(merged);
+}
+
+void stats_report(void)
+{
+    uint64_t totals[STAT_NCOUNTERS] = {0};
+    uint64_t ops = 0;
+    double secs;
+    int i, c;
+
+    secs = elapsed(&start_time, &stop_time);
+    if (secs <= 0)
+        secs = 1e-9;
+
+    printf("\nThroughput over %.2f s with %d client(s):\n", secs, nslots);
+    printf("  %6s %12s %12s\n", "thread", "ops", "ops/s");
+    for (i = 0; i < nslots; ++i)
+    {
+        uint64_t n = slot_total(&slots[i], totals);
+        ops += n;
+        printf("  %6d %12llu %12.0f\n", i, (unsigned long long)n, n / secs);
+    }
+    printf("  %6s %12llu %12.0f\n", "total", (unsigned long long)ops, ops / secs);
+
+    printf("\n  Outcomes:\n");
+    for (c = 0; c < STAT_NCOUNTERS; ++c)
+        printf("  %14s %12llu %12.0f/s\n", counter_names[c],
+               (unsigned long long)totals[c], totals[c] / secs);
+
+    report_latency();
+    fflush(stdout);
+}
@@ -0,0 +1,145 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* Per-thread operation counters and latency histograms for the
+ * simulator clients.
+ *
+ * Each client thread owns exactly one slot and is the only writer to
+ * it; the main thread reads the counters once a second to build the
+ * throughput time series, and merges the histograms after the clients
+ * have been joined.  Slots are padded to a cache line so that counting
+ * never bounces lines between cores.
+ */
+
+enum stat_counter {
+    STAT_SEARCH_HIT,
+    STAT_SEARCH_MISS,
+    STAT_INSERT_OK,
+    STAT_INSERT_DUP,
+    STAT_DELETE_OK,
+    STAT_DELETE_ABSENT,
+    STAT_NCOUNTERS
+};
+
+/* Latency is tracked per operation type.  An insert that had to block
+ * in the squatting wait is accounted separately so that time spent
+ * asleep does not pollute the normal insert distribution.
+ */
+enum stat_op {
+    OP_SEARCH,
+    OP_INSERT,
+    OP_DELETE,
+    OP_SQUAT,
+    OP_NTYPES
+};
+
+/* Log-linear (HDR-style) histogram of nanosecond latencies.  Values
+ * below 2^HIST_SUB_BITS get an exact bucket; above that, every power
+ * of two is split into 2^HIST_SUB_BITS linear sub-buckets, bounding
+ * the relative error at about 3% over the full 64-bit range.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct latency_hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[HIST_BUCKETS];
+};
+
+struct client_stats {
+    uint64_t count[STAT_NCOUNTERS];
+    struct latency_hist latency[OP_NTYPES] __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+/* Allocate one zeroed slot per client thread. */
+void stats_init(int numthreads);
+
+/* Slot owned by client thread id (0-based). */
+struct client_stats *stats_slot(int id);
+
+/* Bump a counter.  Only the owning thread may call this; the relaxed
+ * store keeps the concurrent reader in the main thread well-defined
+ * without paying for a locked add.
+ */
+static inline void stats_count(struct client_stats *stats, enum stat_counter c)
+{
+    __atomic_store_n(&stats->count[c], stats->count[c] + 1, __ATOMIC_RELAXED);
+}
+
+/* Monotonic timestamp in nanoseconds.  clock_gettime() is served from
+ * the vDSO, so a pair of calls costs a few tens of nanoseconds.
+ */
+static inline uint64_t stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline unsigned hist_bucket(uint64_t ns)
+{
+    unsigned shift;
+    if (ns < HIST_SUB_COUNT)
+        return (unsigned)ns;
+    shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) |
+           (unsigned)((ns >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+static inline void hist_record(struct latency_hist *hist, uint64_t ns)
+{
+    hist->bucket[hist_bucket(ns)]++;
+    hist->count++;
+    if (ns > hist->max)
+        hist->max = ns;
+}
+
+/* Record the result and latency of each public trie operation. */
+static inline void stats_search(struct client_stats *stats, int found, uint64_t ns)
+{
+    stats_count(stats, found ? STAT_SEARCH_HIT : STAT_SEARCH_MISS);
+    hist_record(&stats->latency[OP_SEARCH], ns);
+}
+
+static inline void stats_insert(struct client_stats *stats, int inserted,
+                                int squatted, uint64_t ns)
+{
+    stats_count(stats, inserted ? STAT_INSERT_OK : STAT_INSERT_DUP);
+    hist_record(&stats->latency[squatted ? OP_SQUAT : OP_INSERT], ns);
+}
+
+static inline void stats_delete(struct client_stats *stats, int deleted, uint64_t ns)
+{
+    stats_count(stats, deleted ? STAT_DELETE_OK : STAT_DELETE_ABSENT);
+    hist_record(&stats->latency[OP_DELETE], ns);
+}
+
+/* Mark the start of the measured run. */
+void stats_start(void);
+
+/* Mark the end of the measured run (after the clients are joined). */
+void stats_stop(void);
+
+/* Same, but at a stats_clock() time already taken, e.g. when the last
+ * replay client ran out of records.
+ */
+void stats_stop_at(uint64_t ns);
+
+/* Completed operations across all clients, and the measured run time. */
+uint64_t stats_total_ops(void);
+double stats_elapsed(void);
+
+/* Print one line of the per-second time series (called by main). */
+void stats_tick(void);
+
+/* Print the end-of-run summary: totals, per-thread and aggregate ops/sec,
+ * and the merged latency percentiles for each operation type.
+ */
+void stats_report(void);
+
+#endif /* __STATS_H__ */
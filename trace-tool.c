@@ -0,0 +1,230 @@
+/* dns-trace: convert query logs to and from the binary trace format. */
+#include "trace.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// "a.b.c.d" or a plain integer in 32 bits; returns 0 if neither.
+static int parse_ip(const char *s, size_t length, int32_t *ip)
+{
+    char buf[32];
+    unsigned a, b, c, d;
+    char *end;
+    long long value;
+
+    if (length == 0 || length >= sizeof(buf))
+        return 0;
+    memcpy(buf, s, length);
+    buf[length] = 0;
+    if (sscanf(buf, "%u.%u.%u.%u", &a, &b, &c, &d) == 4 &&
+        a < 256 && b < 256 && c < 256 && d < 256)
+    {
+        *ip = (int32_t)((a << 24) | (b << 16) | (c << 8) | d);
+        return 1;
+    }
+    // parse wider than 32 bits, so out-of-range values can't wrap
+    value = strtoll(buf, &end, 0);
+    if (end == buf || *end != 0 || value < 0 || value > 0xffffffffLL)
+        return 0;
+    *ip = (int32_t)(uint32_t)value;
+    return 1;
+}
+
+static void print_ip(FILE *out, int32_t ip)
+{
+    uint32_t u = (uint32_t)ip;
+    fprintf(out, "%u.%u.%u.%u", u >> 24, (u >> 16) & 255, (u >> 8) & 255, u & 255);
+}
+
+//////////////////////////////////////////////////////////////////////
+// "op name [ip]" text, one operation per line, '#' starts a comment
+
+static int convert_text(FILE *in, struct trace_writer *w)
+{
+    char line[1024];
+    unsigned long lineno = 0, skipped = 0;
+
+    while (fgets(line, sizeof(line), in))
+    {
+        char *op, *name, *ip, *save = NULL;
+        int32_t addr = 0;
+        int code;
+
+        ++lineno;
+        if (line[0] == '#')
+            continue;
+        op = strtok_r(line, " \t\r\n", &save);
+        if (!op)
+            continue;
+        name = strtok_r(NULL, " \t\r\n", &save);
+        ip = strtok_r(NULL, " \t\r\n", &save);
+        code = trace_parse_op(op, strlen(op));
+        if (code < 0 || !name || (ip && !parse_ip(ip, strlen(ip), &addr)) ||
+            !trace_write(w, code, name, strlen(name), addr, 0))
+            ++skipped;
+    }
+    if (skipped)
+        fprintf(stderr, "skipped %lu of %lu lines\n", skipped, lineno);
+    return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// JSON lines: {"op": "insert", "name": "example.com", "ip": "1.2.3.4",
+//  "ts": 12.5}.  "qname" is accepted for "name"; "ts" (seconds, any
+//  epoch) is optional and only its differences are kept.  This is a
+//  field scanner, not a JSON parser: values must be plain strings or
+//  numbers.
+
+static const char *json_field(const char *line, const char *field, size_t *length)
+{
+    char pattern[32];
+    const char *p, *v;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\"", field);
+    for (p = strstr(line, pattern); p; p = strstr(p + 1, pattern))
+    {
+        v = p + strlen(pattern);
+        while (isspace((unsigned char)*v))
+            ++v;
+        if (*v != ':')
+            continue;
+        ++v;
+        while (isspace((unsigned char)*v))
+            ++v;
+        if (*v == '"')
+        {
+            const char *end = strchr(++v, '"');
+            if (!end)
+                return NULL;
+            *length = end - v;
+            return v;
+        }
+        *length = strcspn(v, ",} \t\r\n");
+        return *length ? v : NULL;
+    }
+    return NULL;
+}
+
+static int convert_json(FILE *in, struct trace_writer *w)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    unsigned long lineno = 0, skipped = 0;
+    double first_ts = -1;
+
+    while (getline(&line, &cap, in) > 0)
+    {
+        const char *op, *name, *ip, *ts;
+        size_t oplen, namelen, iplen, tslen;
+        int32_t addr = 0;
+        uint64_t at_ns = 0;
+        int code = -1;
+
+        ++lineno;
+        op = json_field(line, "op", &oplen);
+        name = json_field(line, "name", &namelen);
+        if (!name)
+            name = json_field(line, "qname", &namelen);
+        ip = json_field(line, "ip", &iplen);
+        ts = json_field(line, "ts", &tslen);
+        if (op)
+            code = trace_parse_op(op, oplen);
+        if (ts)
+        {
+            double t = strtod(ts, NULL);
+            if (first_ts < 0)
+                first_ts = t;
+            at_ns = t > first_ts ? (uint64_t)((t - first_ts) * 1e9) : 0;
+        }
+        if (code < 0 || !name || (ip && !parse_ip(ip, iplen, &addr)) ||
+            !trace_write(w, code, name, namelen, addr, at_ns))
+            ++skipped;
+    }
+    free(line);
+    if (skipped)
+        fprintf(stderr, "skipped %lu of %lu lines without a usable op/name\n",
+                skipped, lineno);
+    return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static int dump(const char *path)
+{
+    struct trace_map map;
+    const struct trace_record *rec;
+    uint64_t i;
+
+    if (!trace_open(&map, path))
+        return 0;
+    for (i = 0, rec = trace_first(&map); i < map.count; ++i, rec = trace_next(rec))
+    {
+        printf("%s %.*s ", trace_op_name(rec->op), rec->length, rec->key);
+        print_ip(stdout, rec->ip4_address);
+        if (rec->gap_us)
+            printf(" # +%u us", rec->gap_us);
+        printf("\n");
+    }
+    trace_unmap(&map);
+    return 1;
+}
+
+static void help(void)
+{
+    printf("Usage: dns-trace -t input.txt output.trace   convert \"op name ip\" text\n");
+    printf("       dns-trace -j input.jsonl output.trace convert JSON lines\n");
+    printf("       dns-trace -d input.trace              dump a trace as text\n");
+    printf("\nInput '-' reads stdin.\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct trace_writer w;
+    FILE *in;
+    int c, mode = 0, ok;
+
+    while ((c = getopt(argc, argv, "djth")) != -1)
+    {
+        switch (c) {
+            case 'd':
+            case 'j':
+            case 't':
+                mode = c;
+                break;
+            case 'h':
+                help();
+                return EXIT_SUCCESS;
+            default:
+                help();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (mode == 'd' && optind + 1 == argc)
+        return dump(argv[optind]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (!mode || mode == 'd' || optind + 2 != argc)
+    {
+        help();
+        return EXIT_FAILURE;
+    }
+
+    in = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+    if (!in)
+    {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (!trace_create(&w, argv[optind + 1]))
+        return EXIT_FAILURE;
+
+    ok = (mode == 't') ? convert_text(in, &w) : convert_json(in, &w);
+    if (in != stdin)
+        fclose(in);
+    ok = trace_close(&w) && ok;
+    fprintf(stderr, "%llu records written to %s\n",
+            (unsigned long long)w.count, argv[optind + 1]);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
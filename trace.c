@@ -0,0 +1,275 @@
+/* Binary operation traces: recording, merging and mapped replay. */
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *op_names[TRACE_NOPS] = { "search", "insert", "delete" };
+
+const char *trace_op_name(enum trace_op op)
+{
+    return op < TRACE_NOPS ? op_names[op] : "?";
+}
+
+int trace_parse_op(const char *name, size_t length)
+{
+    int op;
+    for (op = 0; op < TRACE_NOPS; ++op)
+    {
+        // accept the full name or its first letter
+        if ((length == strlen(op_names[op]) &&
+             strncasecmp(name, op_names[op], length) == 0) ||
+            (length == 1 && (name[0] | 0x20) == op_names[op][0]))
+            return op;
+    }
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// writer
+
+int trace_create(struct trace_writer *w, const char *path)
+{
+    struct trace_header hdr;
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        perror(path);
+        return 0;
+    }
+
+    // the count is patched in by trace_close()
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+    {
+        perror(path);
+        fclose(f);
+        return 0;
+    }
+    w->file = f;
+    w->count = 0;
+    w->last_us = 0;
+    return 1;
+}
+
+int trace_write(struct trace_writer *w, enum trace_op op, const char *key,
+                size_t length, int32_t ip4_address, uint64_t at_ns)
+{
+    struct trace_record rec;
+    uint64_t at_us = at_ns / 1000, gap;
+
+    if (length == 0 || length > TRACE_MAX_KEY)
+        return 0;
+
+    // gaps are measured between the rounded timestamps, so rounding
+    //  never accumulates into drift over a long trace.
+    gap = at_us > w->last_us ? at_us - w->last_us : 0;
+    if (gap > UINT32_MAX)
+        gap = UINT32_MAX;
+    if (at_us > w->last_us)
+        w->last_us = at_us;
+
+    rec.op = op;
+    rec.length = (uint8_t)length;
+    rec.gap_us = (uint32_t)gap;
+    rec.ip4_address = ip4_address;
+    if (fwrite(&rec, sizeof(rec), 1, w->file) != 1 ||
+        fwrite(key, length, 1, w->file) != 1)
+    {
+        perror("Failed to write trace record");
+        return 0;
+    }
+    w->count++;
+    return 1;
+}
+
+int trace_close(struct trace_writer *w)
+{
+    FILE *f = w->file;
+    int ok = 1;
+
+    if (!f)
+        return 0;
+    if (fseek(f, offsetof(struct trace_header, count), SEEK_SET) != 0 ||
+        fwrite(&w->count, sizeof(w->count), 1, f) != 1)
+    {
+        perror("Failed to finish trace");
+        ok = 0;
+    }
+    if (fclose(f) != 0)
+        ok = 0;
+    w->file = NULL;
+    return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// per-thread recording buffers
+
+// in-memory record: absolute timestamp instead of a gap, so that
+//  buffers from different threads can be merged afterwards.
+struct buffered_record {
+    uint64_t at_ns;
+    uint8_t op;
+    uint8_t length;
+    int32_t ip4_address;
+    char key[];
+} __attribute__((packed));
+
+void trace_buffer_append(struct trace_buffer *buf, enum trace_op op,
+                         const char *key, size_t length,
+                         int32_t ip4_address, uint64_t at_ns)
+{
+    struct buffered_record *rec;
+    size_t need = sizeof(*rec) + length;
+
+    if (length == 0 || length > TRACE_MAX_KEY)
+        return;
+    if (buf->used + need > buf->cap)
+    {
+        size_t cap = buf->cap ? buf->cap * 2 : (1 << 20);
+        char *data = realloc(buf->data, cap);
+        if (!data)
+            return;     // out of memory: drop the record, keep running
+        buf->data = data;
+        buf->cap = cap;
+    }
+    rec = (struct buffered_record *)(buf->data + buf->used);
+    rec->at_ns = at_ns;
+    rec->op = op;
+    rec->length = (uint8_t)length;
+    rec->ip4_address = ip4_address;
+    memcpy(rec->key, key, length);
+    buf->used += need;
+    buf->count++;
+}
+
+void trace_buffer_free(struct trace_buffer *buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+int trace_merge(const char *path, struct trace_buffer *bufs, int n)
+{
+    struct trace_writer w;
+    size_t *pos = calloc(n, sizeof(*pos));
+    int i, ok = 1;
+
+    if (!pos || !trace_create(&w, path))
+    {
+        free(pos);
+        return 0;
+    }
+
+    // n is the client count, so a linear scan for the earliest head
+    //  is cheaper than maintaining a heap.
+    for (;;)
+    {
+        struct buffered_record *best = NULL, *rec;
+        int from = -1;
+        for (i = 0; i < n; ++i)
+        {
+            if (pos[i] >= bufs[i].used)
+                continue;
+            rec = (struct buffered_record *)(bufs[i].data + pos[i]);
+            if (!best || rec->at_ns < best->at_ns)
+            {
+                best = rec;
+                from = i;
+            }
+        }
+        if (!best)
+            break;
+        if (!trace_write(&w, best->op, best->key, best->length,
+                         best->ip4_address, best->at_ns))
+        {
+            ok = 0;
+            break;
+        }
+        pos[from] += sizeof(*best) + best->length;
+    }
+
+    free(pos);
+    return trace_close(&w) && ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// mapped reader
+
+int trace_open(struct trace_map *map, const char *path)
+{
+    const struct trace_header *hdr;
+    const struct trace_record *rec;
+    const unsigned char *end;
+    struct stat st;
+    uint64_t i;
+    void *base;
+    int fd;
+
+    memset(map, 0, sizeof(*map));
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size < sizeof(*hdr))
+    {
+        fprintf(stderr, "%s: too short to be a trace\n", path);
+        close(fd);
+        return 0;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror(path);
+        return 0;
+    }
+    map->base = base;
+    map->size = st.st_size;
+
+    hdr = base;
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+        trace_unmap(map);
+        return 0;
+    }
+
+    // walk the records once so replay can trust every length byte.
+    end = map->base + map->size;
+    rec = trace_first(map);
+    for (i = 0; i < hdr->count; ++i)
+    {
+        if ((const unsigned char *)rec + sizeof(*rec) > end ||
+            (const unsigned char *)trace_next(rec) > end)
+        {
+            fprintf(stderr, "%s: truncated after %llu of %llu records\n", path,
+                    (unsigned long long)i, (unsigned long long)hdr->count);
+            break;
+        }
+        rec = trace_next(rec);
+    }
+    map->count = i;
+    return 1;
+}
+
+void trace_unmap(struct trace_map *map)
+{
+    if (map->base)
+        munmap((void *)map->base, map->size);
+    memset(map, 0, sizeof(*map));
+}
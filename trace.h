@@ -0,0 +1,107 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compact binary traces of trie operations.
+ *
+ * A trace file is a fixed header followed by variable-length records,
+ * each a packed 10-byte head and then the key bytes (no NUL):
+ *
+ *   offset  size  field
+ *        0     1  op (enum trace_op)
+ *        1     1  key length
+ *        2     4  gap since the previous record, in microseconds
+ *        6     4  IPv4 address (insert payload; 0 otherwise)
+ *       10     n  key
+ *
+ * All integers are in host byte order, so a trace only replays on a
+ * machine of the same endianness (elsewhere the version won't match).
+ * Traces can be recorded from a simulator run (-w), converted from
+ * text or JSON lines by dns-trace, and replayed (-r) by memory-mapping
+ * the file.
+ */
+
+#define TRACE_MAGIC "DNSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_MAX_KEY 255
+
+enum trace_op {
+    TRACE_SEARCH,
+    TRACE_INSERT,
+    TRACE_DELETE,
+    TRACE_NOPS
+};
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;         /* # records that follow */
+};
+
+struct trace_record {
+    uint8_t op;
+    uint8_t length;
+    uint32_t gap_us;
+    int32_t ip4_address;
+    char key[];
+} __attribute__((packed));
+
+/* Streaming writer.  Records must be written in time order. */
+struct trace_writer {
+    void *file;
+    uint64_t count;
+    uint64_t last_us;
+};
+
+/* Returns 0 and prints a message on failure. */
+int trace_create(struct trace_writer *w, const char *path);
+int trace_write(struct trace_writer *w, enum trace_op op, const char *key,
+                size_t length, int32_t ip4_address, uint64_t at_ns);
+int trace_close(struct trace_writer *w);
+
+/* In-memory per-thread buffer used while recording a run.  Each
+ * client appends to its own buffer without synchronisation; the
+ * buffers are merged into one time-ordered file after the run.
+ */
+struct trace_buffer {
+    char *data;
+    size_t used, cap;
+    uint64_t count;
+};
+
+void trace_buffer_append(struct trace_buffer *buf, enum trace_op op,
+                         const char *key, size_t length,
+                         int32_t ip4_address, uint64_t at_ns);
+void trace_buffer_free(struct trace_buffer *buf);
+
+/* Merge n buffers by timestamp into a new trace file. */
+int trace_merge(const char *path, struct trace_buffer *bufs, int n);
+
+/* Read-only mapping of a trace file. */
+struct trace_map {
+    const unsigned char *base;
+    size_t size;
+    uint64_t count;
+};
+
+int trace_open(struct trace_map *map, const char *path);
+void trace_unmap(struct trace_map *map);
+
+static inline const struct trace_record *trace_first(const struct trace_map *map)
+{
+    return (const struct trace_record *)(map->base + sizeof(struct trace_header));
+}
+
+static inline const struct trace_record *trace_next(const struct trace_record *rec)
+{
+    return (const struct trace_record *)(rec->key + rec->length);
+}
+
+/* Printable name of an op, and the reverse ("search", "s", ...). */
+const char *trace_op_name(enum trace_op op);
+int trace_parse_op(const char *name, size_t length);
+
+#endif /* __TRACE_H__ */
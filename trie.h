@@ -1,46 +1,81 @@
-#ifndef __TRIE_H__
-#define __TRIE_H__
-
-#include <stdint.h>
-#include <stdlib.h>
-#include <assert.h>
-
-/* A simple (reverse) trie interface */
-
-/* Optional init routine.  May not be required. */
-void init (int numthreads);
-
-/* Return 1 on success, 0 on failure */
-int insert (const char *string, size_t strlen, int32_t ip4_address);
-
-/* Return 1 if the key is found, 0 if not. 
- * If ip4_address is not NULL, store the IP 
- * here.  
- */
-int search(const char *string, size_t strlen, int32_t *ip4_address);
-
-/* Return 1 if the key is found and deleted, 0 if not. */
-int delete  (const char *string, size_t strlen);
-
-/* Called when the main thread is shutting down */
-void shutdown();
-
-/* Print the structure of the tree.  Mostly useful for debugging. */
-void print (); 
-
-/* Determines whether to allow blocking until 
- * a name is available.
- */
-extern int allow_squatting;
-extern volatile int finished;
-
-#define DEBUG =1
-#ifdef DEBUG
-#define DEBUG_PRINT(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define DEBUG_PRINT(...)
-#endif
-
-
-
-#endif /* __TRIE_H__ */ 
+#ifndef __TRIE_H__
+#define __TRIE_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/* A simple (reverse) trie interface */
+
+/* Optional init routine.  May not be required. */
+void init (int numthreads);
+
+/* Return 1 on success, 0 on failure */
+int insert (const char *string, size_t strlen, int32_t ip4_address);
+
+/* Return 1 if the key is found, 0 if not. 
+ * If ip4_address is not NULL, store the IP 
+ * here.  
+ */
+int search(const char *string, size_t strlen, int32_t *ip4_address);
+
+/* Return 1 if the key is found and deleted, 0 if not. */
+int delete  (const char *string, size_t strlen);
+
+/* Load n records at once: keys[i], lens[i] chars long (no NUL needed),
+ * maps to ips[i].  Meant for pre-populating an empty tree, which is
+ * then built bottom-up in one pass; a tree that already has entries
+ * gets the records insert()ed one by one.  Empty names, names longer
+ * than 253 chars and ip 0 are skipped, and only the first of several
+ * records with the same name is kept.  Returns the number stored.
+ */
+int bulk_load (const char **keys, const size_t *lens, const int32_t *ips, size_t n);
+
+/* Called when the main thread is shutting down */
+void shutdown();
+
+/* Free every node at once.  Called by the main thread after all
+ * clients have been joined; the tree is empty afterwards.
+ */
+void destroy ();
+
+/* Print the structure of the tree.  Mostly useful for debugging. */
+void print (); 
+
+/* Determines whether to allow blocking until 
+ * a name is available.
+ */
+extern int allow_squatting;
+extern volatile int finished;
+
+/* The number of server threads that own the tree and run every
+ * client's operations for it (see delegate.h), or 0 if the clients
+ * run their own.  Set before init().
+ */
+extern int delegate_servers;
+
+/* The number of copies of the tree to keep, one per NUMA node, in
+ * sync through a log of writes (see replica.h); 0 for a single tree.
+ * Only the sequential trie keeps copies; the others' init() refuses
+ * any.  Set before init().
+ */
+extern int replicas;
+
+/* Set by insert() when it had to block (squat) until the name was
+ * released.  The simulator clears it before each insert so that time
+ * spent asleep is reported apart from the normal insert latency.
+ */
+extern __thread int squatted;
+
+/* Per-operation tracing drowns out everything else when measuring
+ * throughput, so it is opt-in: build with "make DEBUG=1".
+ */
+#ifdef DEBUG
+#define DEBUG_PRINT(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG_PRINT(...)
+#endif
+
+
+
+#endif /* __TRIE_H__ */ 
@@ -0,0 +1,439 @@
+/* Configurable synthetic workload for the simulator clients. */
+#include "workload.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct workload workload = {
+    .search_weight = 1, .insert_weight = 1, .delete_weight = 1,
+    .len_dist = LEN_UNIFORM, .len_min = 1, .len_max = 63,   /* one DNS label */
+    .len_mean = 16, .len_sd = 8,
+    .key_dist = KEYS_UNIFORM, .theta = 0.99,
+    .hot_frac = 0.2, .hot_prob = 0.8,
+    .universe = 0,
+};
+
+// bounded key universe: all names back to back, indexed by offset.
+static char *key_data = NULL;
+static size_t *key_off = NULL;
+static unsigned char *key_len = NULL;
+
+// precomputed zipf constants (Gray et al., "Quickly generating
+//  billion-record synthetic databases", SIGMOD '94)
+static double zipf_zetan, zipf_alpha, zipf_eta, zipf_half_pow;
+
+//////////////////////////////////////////////////////////////////////
+// random helpers on top of rand_r()
+
+static inline double rand_unit(unsigned int *seed)
+{
+    return rand_r(seed) / ((double)RAND_MAX + 1.0);
+}
+
+// uniform in [0, n); rand_r() only has 31 bits, so stitch two together
+//  when the range needs it.
+static inline size_t rand_below(unsigned int *seed, size_t n)
+{
+    uint64_t r = (uint32_t)rand_r(seed);
+    if (n > RAND_MAX)
+        r = (r << 31) | (uint32_t)rand_r(seed);
+    return (size_t)(r % n);
+}
+
+static int draw_length(unsigned int *seed)
+{
+    int len;
+    switch (workload.len_dist)
+    {
+        case LEN_FIXED:
+            return workload.len_min;
+        case LEN_NORMAL:
+        {
+            // Box-Muller; one of the pair is enough here.
+            double u1 = 1.0 - rand_unit(seed), u2 = rand_unit(seed);
+            double z = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+            len = (int)lround(workload.len_mean + z * workload.len_sd);
+            break;
+        }
+        default:
+            len = workload.len_min +
+                  rand_r(seed) % (workload.len_max - workload.len_min + 1);
+            break;
+    }
+    if (len < 1)
+        len = 1;
+    if (len > WORKLOAD_MAX_KEY)
+        len = WORKLOAD_MAX_KEY;
+    return len;
+}
+
+// random lowercase name; five random bits per char, as the original
+//  client did (values past 'z' fold onto 'z').
+static void random_name(unsigned int *seed, char *buf, int length)
+{
+    int i, j;
+    for (j = 0; j < length; j += 6)
+    {
+        int32_t chars = rand_r(seed);
+        for (i = 0; i < 6 && (i+j) < length; i++)
+        {
+            char val = ((chars >> (5 * i)) & 31);
+            if (val > 25)
+                val = 25;
+            buf[j+i] = 'a' + val;
+        }
+    }
+    buf[length] = 0;
+}
+
+static size_t draw_index(unsigned int *seed)
+{
+    size_t n = workload.universe;
+    switch (workload.key_dist)
+    {
+        case KEYS_ZIPF:
+        {
+            double u = rand_unit(seed);
+            double uz = u * zipf_zetan;
+            size_t rank;
+            if (uz < 1.0)
+                return 0;
+            if (uz < 1.0 + zipf_half_pow)
+                return 1;
+            rank = (size_t)(n * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+            return rank < n ? rank : n - 1;
+        }
+        case KEYS_HOTSPOT:
+        {
+            size_t hot = (size_t)(workload.hot_frac * n);
+            if (hot == 0)
+                hot = 1;
+            if (hot >= n || rand_unit(seed) < workload.hot_prob)
+                return rand_below(seed, hot);
+            return hot + rand_below(seed, n - hot);
+        }
+        default:
+            return rand_below(seed, n);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// option parsing
+
+int workload_parse_mix(const char *spec)
+{
+    unsigned s, i, d;
+    if (sscanf(spec, "%u:%u:%u", &s, &i, &d) != 3 || s + i + d == 0)
+    {
+        fprintf(stderr, "Bad op mix '%s', expected SEARCH:INSERT:DELETE\n", spec);
+        return 0;
+    }
+    workload.search_weight = s;
+    workload.insert_weight = i;
+    workload.delete_weight = d;
+    return 1;
+}
+
+int workload_parse_lengths(const char *spec)
+{
+    int a, b;
+    double m, sd;
+    if (sscanf(spec, "uniform:%d:%d", &a, &b) == 2 &&
+        a >= 1 && a <= b && b <= WORKLOAD_MAX_KEY)
+    {
+        workload.len_dist = LEN_UNIFORM;
+        workload.len_min = a;
+        workload.len_max = b;
+        return 1;
+    }
+    if (sscanf(spec, "fixed:%d", &a) == 1 && a >= 1 && a <= WORKLOAD_MAX_KEY)
+    {
+        workload.len_dist = LEN_FIXED;
+        workload.len_min = workload.len_max = a;
+        return 1;
+    }
+    if (sscanf(spec, "normal:%lf:%lf", &m, &sd) == 2 && m >= 1 && sd >= 0)
+    {
+        workload.len_dist = LEN_NORMAL;
+        workload.len_mean = m;
+        workload.len_sd = sd;
+        return 1;
+    }
+    fprintf(stderr, "Bad length distribution '%s', expected uniform:MIN:MAX, "
+            "fixed:N or normal:MEAN:SD (lengths 1..%d)\n", spec, WORKLOAD_MAX_KEY);
+    return 0;
+}
+
+int workload_parse_keys(const char *spec)
+{
+    if (strcmp(spec, "uniform") == 0)
+    {
+        workload.key_dist = KEYS_UNIFORM;
+        return 1;
+    }
+    if (strncmp(spec, "zipf", 4) == 0)
+    {
+        double theta = workload.theta;
+        if ((spec[4] == 0 || sscanf(spec, "zipf:%lf", &theta) == 1) &&
+            theta > 0 && theta < 1)
+        {
+            workload.key_dist = KEYS_ZIPF;
+            workload.theta = theta;
+            return 1;
+        }
+    }
+    if (strncmp(spec, "hotspot", 7) == 0)
+    {
+        double frac = workload.hot_frac, prob = workload.hot_prob;
+        if ((spec[7] == 0 || sscanf(spec, "hotspot:%lf:%lf", &frac, &prob) == 2) &&
+            frac > 0 && frac <= 1 && prob >= 0 && prob <= 1)
+        {
+            workload.key_dist = KEYS_HOTSPOT;
+            workload.hot_frac = frac;
+            workload.hot_prob = prob;
+            return 1;
+        }
+    }
+    fprintf(stderr, "Bad key distribution '%s', expected uniform, "
+            "zipf[:THETA] (0 < THETA < 1) or hotspot[:FRAC:PROB]\n", spec);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// setup
+
+// FNV-1a, only used to de-duplicate the universe at setup.
+static uint64_t hash_name(const char *s, int len)
+{
+    uint64_t h = 1469598103934665603ull;
+    while (len--)
+        h = (h ^ (unsigned char)*s++) * 1099511628211ull;
+    return h;
+}
+
+static void build_universe(unsigned int seed)
+{
+    size_t n = workload.universe, i, used = 0, mask, slots = 1;
+    size_t *table;
+    char buf[WORKLOAD_MAX_KEY+1];
+
+    while (slots < 2 * n)
+        slots <<= 1;
+    mask = slots - 1;
+
+    key_data = malloc(n * (WORKLOAD_MAX_KEY + 1));
+    key_off = malloc(n * sizeof(*key_off));
+    key_len = malloc(n);
+    table = calloc(slots, sizeof(*table));
+    if (!key_data || !key_off || !key_len || !table)
+    {
+        perror("Failed to allocate the key universe");
+        exit(1);
+    }
+
+    // draw distinct names; when the length distribution cannot supply
+    //  enough of them, give up after a few tries and accept a repeat.
+    for (i = 0; i < n; ++i)
+    {
+        int tries, len = 0;
+        size_t slot = 0;
+        for (tries = 0; tries < 64; ++tries)
+        {
+            len = draw_length(&seed);
+            random_name(&seed, buf, len);
+            slot = hash_name(buf, len) & mask;
+            while (table[slot])
+            {
+                size_t j = table[slot] - 1;
+                if (key_len[j] == len && memcmp(key_data + key_off[j], buf, len) == 0)
+                    break;
+                slot = (slot + 1) & mask;
+            }
+            if (!table[slot])
+                break;
+        }
+        memcpy(key_data + used, buf, len + 1);
+        key_off[i] = used;
+        key_len[i] = len;
+        used += len + 1;
+        if (!table[slot])
+            table[slot] = i + 1;
+    }
+    free(table);
+    key_data = realloc(key_data, used);
+}
+
+static void build_zipf(void)
+{
+    double theta = workload.theta, zeta2;
+    size_t n = workload.universe, i;
+
+    zipf_zetan = 0;
+    for (i = 1; i <= n; ++i)
+        zipf_zetan += 1.0 / pow((double)i, theta);
+    zeta2 = 1.0 + pow(0.5, theta);
+    zipf_alpha = 1.0 / (1.0 - theta);
+    zipf_eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zipf_zetan);
+    zipf_half_pow = pow(0.5, theta);
+}
+
+void workload_setup(unsigned int seed)
+{
+    if (workload.universe == 0)
+        return;
+    build_universe(seed);
+    if (workload.key_dist == KEYS_ZIPF)
+        build_zipf();
+}
+
+void workload_print(void)
+{
+    unsigned total = workload.search_weight + workload.insert_weight +
+                     workload.delete_weight;
+
+    printf("Workload: %.1f%% search, %.1f%% insert, %.1f%% delete; ",
+           100.0 * workload.search_weight / total,
+           100.0 * workload.insert_weight / total,
+           100.0 * workload.delete_weight / total);
+    switch (workload.len_dist)
+    {
+        case LEN_FIXED:
+            printf("key length %d; ", workload.len_min);
+            break;
+        case LEN_NORMAL:
+            printf("key length ~N(%.1f, %.1f); ", workload.len_mean, workload.len_sd);
+            break;
+        default:
+            printf("key length %d..%d; ", workload.len_min, workload.len_max);
+            break;
+    }
+    if (workload.universe == 0)
+    {
+        printf("unbounded random keys\n");
+        return;
+    }
+    printf("%zu keys, ", workload.universe);
+    switch (workload.key_dist)
+    {
+        case KEYS_ZIPF:
+            printf("zipf theta %.2f\n", workload.theta);
+            break;
+        case KEYS_HOTSPOT:
+            printf("%.0f%% of ops on %.0f%% of keys\n",
+                   100 * workload.hot_prob, 100 * workload.hot_frac);
+            break;
+        default:
+            printf("uniform popularity\n");
+            break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// per-operation generation
+
+const char *workload_key(size_t i, int *length)
+{
+    *length = key_len[i];
+    return key_data + key_off[i];
+}
+
+void workload_next(unsigned int *seed, struct workload_op *op, char *buf)
+{
+    unsigned r = rand_r(seed) % (workload.search_weight + workload.insert_weight +
+                                 workload.delete_weight);
+
+    if (r < workload.search_weight)
+        op->type = WL_SEARCH;
+    else if (r < workload.search_weight + workload.insert_weight)
+        op->type = WL_INSERT;
+    else
+        op->type = WL_DELETE;
+
+    if (workload.universe)
+    {
+        op->key = workload_key(draw_index(seed), &op->length);
+    }
+    else
+    {
+        op->length = draw_length(seed);
+        random_name(seed, buf, op->length);
+        op->key = buf;
+    }
+
+    op->ip4_address = (op->type == WL_INSERT) ? rand_r(seed) % RAND_MAX + 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// pre-generated pools
+
+void workload_pool_fill(struct workload_pool *pool, unsigned int seed, size_t count)
+{
+    struct workload_op op;
+    char buf[WORKLOAD_MAX_KEY+1];
+    size_t i, used = 0, cap = count * 16 + WORKLOAD_MAX_KEY + 1;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->count = count;
+    pool->names = malloc(cap);
+    pool->offset = malloc(count * sizeof(*pool->offset));
+    pool->length = malloc(count);
+    pool->type = malloc(count);
+    pool->ip4_address = malloc(count * sizeof(*pool->ip4_address));
+    if (!pool->names || !pool->offset || !pool->length || !pool->type ||
+        !pool->ip4_address)
+    {
+        perror("Failed to allocate a workload pool");
+        exit(1);
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        workload_next(&seed, &op, buf);
+
+        // grow the name buffer geometrically; offsets stay valid.
+        if (used + op.length + 1 > cap)
+        {
+            cap *= 2;
+            pool->names = realloc(pool->names, cap);
+            if (!pool->names)
+            {
+                perror("Failed to grow a workload pool");
+                exit(1);
+            }
+        }
+        if (used + op.length + 1 > UINT32_MAX)
+        {
+            fprintf(stderr, "Workload pool too large (%zu ops)\n", count);
+            exit(1);
+        }
+        memcpy(pool->names + used, op.key, op.length);
+        pool->names[used + op.length] = 0;
+        pool->offset[i] = (uint32_t)used;
+        pool->length[i] = op.length;
+        pool->type[i] = op.type;
+        pool->ip4_address[i] = op.ip4_address;
+        used += op.length + 1;
+    }
+    pool->names = realloc(pool->names, used ? used : 1);
+}
+
+void workload_pool_free(struct workload_pool *pool)
+{
+    free(pool->names);
+    free(pool->offset);
+    free(pool->length);
+    free(pool->type);
+    free(pool->ip4_address);
+    memset(pool, 0, sizeof(*pool));
+}
+
+size_t workload_pool_bytes(const struct workload_pool *pool)
+{
+    size_t bytes = pool->count * (sizeof(*pool->offset) + 2 +
+                                  sizeof(*pool->ip4_address));
+    if (pool->count)
+        bytes += pool->offset[pool->count - 1] + pool->length[pool->count - 1] + 1;
+    return bytes;
+}
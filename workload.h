@@ -0,0 +1,136 @@
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Synthetic workload generator for the simulator clients.
+ *
+ * A workload is described by three independent knobs, each settable
+ * from the command line:
+ *
+ *   - the operation mix (relative weights of search/insert/delete),
+ *   - the key-length distribution,
+ *   - the key-popularity distribution over a bounded key universe.
+ *
+ * With an unbounded universe (the default) every operation draws a
+ * fresh random name, which reproduces the original uniform stress
+ * client.  With a bounded universe the names are generated once at
+ * setup and operations pick among them, so searches actually hit.
+ */
+
+/* Longest name the generator will produce (excluding the NUL): the
+ * longest DNS name.  The default lengths stay within 1..63.
+ */
+#define WORKLOAD_MAX_KEY 253
+
+enum workload_op_type {
+    WL_SEARCH,
+    WL_INSERT,
+    WL_DELETE,
+};
+
+enum workload_key_dist {
+    KEYS_UNIFORM,   /* every key equally likely */
+    KEYS_ZIPF,      /* rank r drawn with probability ~ 1/r^theta */
+    KEYS_HOTSPOT,   /* hot_prob of ops go to the first hot_frac of keys */
+};
+
+enum workload_len_dist {
+    LEN_UNIFORM,    /* uniform in [len_min, len_max] */
+    LEN_FIXED,      /* always len_min */
+    LEN_NORMAL,     /* normal(len_mean, len_sd), clamped to [1, MAX] */
+};
+
+struct workload {
+    /* operation mix, as relative weights */
+    unsigned search_weight, insert_weight, delete_weight;
+
+    /* key length */
+    enum workload_len_dist len_dist;
+    int len_min, len_max;
+    double len_mean, len_sd;
+
+    /* key popularity */
+    enum workload_key_dist key_dist;
+    double theta;                   /* zipf skew */
+    double hot_frac, hot_prob;      /* hotspot shape */
+    size_t universe;                /* # distinct keys, 0 = unbounded */
+};
+
+/* One generated operation.  key points either into the universe
+ * table or into the caller's scratch buffer.
+ */
+struct workload_op {
+    enum workload_op_type type;
+    const char *key;
+    int length;
+    int32_t ip4_address;
+};
+
+/* A pre-generated stream of operations for one client.  Names are
+ * packed back to back in one buffer and the per-op fields live in
+ * parallel arrays, so the timed loop only walks memory sequentially
+ * instead of calling rand_r() and building strings as it goes.  The
+ * stream wraps around when the run outlasts it.
+ */
+struct workload_pool {
+    size_t count;           /* # operations */
+    size_t next;            /* cursor for workload_pool_next() */
+    char *names;            /* NUL-terminated names, back to back */
+    uint32_t *offset;       /* start of op i's name in names */
+    unsigned char *length;  /* length of op i's name */
+    unsigned char *type;    /* enum workload_op_type */
+    int32_t *ip4_address;   /* insert payload (0 for other ops) */
+};
+
+/* The workload shared by all clients; defaults to the original mix. */
+extern struct workload workload;
+
+/* Command-line parsers.  Each returns 0 and prints a message if the
+ * specification is malformed.
+ *
+ *   mix:     "S:I:D"                e.g. "95:4:1"
+ *   lengths: "uniform:MIN:MAX" | "fixed:N" | "normal:MEAN:SD"
+ *   keys:    "uniform" | "zipf[:THETA]" | "hotspot[:FRAC:PROB]"
+ */
+int workload_parse_mix(const char *spec);
+int workload_parse_lengths(const char *spec);
+int workload_parse_keys(const char *spec);
+
+/* Build the key universe and distribution tables.  Must be called
+ * once, after option parsing and before any client starts.
+ */
+void workload_setup(unsigned int seed);
+
+/* Describe the workload on stdout. */
+void workload_print(void);
+
+/* Key i of the bounded universe. */
+const char *workload_key(size_t i, int *length);
+
+/* Draw the next operation.  buf must hold WORKLOAD_MAX_KEY+1 chars. */
+void workload_next(unsigned int *seed, struct workload_op *op, char *buf);
+
+/* Fill a pool with count operations drawn from the workload. */
+void workload_pool_fill(struct workload_pool *pool, unsigned int seed, size_t count);
+
+/* Release a pool's memory. */
+void workload_pool_free(struct workload_pool *pool);
+
+/* Bytes held by a pool. */
+size_t workload_pool_bytes(const struct workload_pool *pool);
+
+/* Next operation from the pool, wrapping at the end. */
+static inline void workload_pool_next(struct workload_pool *pool,
+                                      struct workload_op *op)
+{
+    size_t i = pool->next;
+    op->type = (enum workload_op_type)pool->type[i];
+    op->key = pool->names + pool->offset[i];
+    op->length = pool->length[i];
+    op->ip4_address = pool->ip4_address[i];
+    pool->next = (i + 1 == pool->count) ? 0 : i + 1;
+}
+
+#endif /* __WORKLOAD_H__ */
@@ -0,0 +1,145 @@
+/* Memory-mapped zone file parser. */
+#include "zone.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int zone_open(struct zone_file *zone, const char *path)
+{
+    struct stat st;
+    void *base;
+    int fd;
+
+    memset(zone, 0, sizeof(*zone));
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+
+    // an empty file maps to nothing, which is a valid empty zone
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror(path);
+        return 0;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    zone->base = zone->cursor = base;
+    zone->size = st.st_size;
+    return 1;
+}
+
+void zone_close(struct zone_file *zone)
+{
+    if (zone->base)
+        munmap((void *)zone->base, zone->size);
+    memset(zone, 0, sizeof(*zone));
+}
+
+static inline int is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// dotted quad or plain decimal, consuming [p, end).  Returns 0 if the
+//  field is anything else, or a plain decimal past 32 bits.
+static int parse_ip(const char *p, const char *end, int32_t *ip)
+{
+    uint64_t part = 0;
+    uint32_t value = 0;
+    int dots = 0, digits = 0;
+
+    for (; p < end; ++p)
+    {
+        if (*p >= '0' && *p <= '9')
+        {
+            // 64 bits can't wrap before this catches it
+            part = part * 10 + (*p - '0');
+            if (part > UINT32_MAX)
+                return 0;
+            digits = 1;
+        }
+        else if (*p == '.' && digits && dots < 3)
+        {
+            if (part > 255)
+                return 0;
+            value = (value << 8) | part;
+            part = digits = 0;
+            ++dots;
+        }
+        else
+            return 0;
+    }
+    if (!digits)
+        return 0;
+    if (dots == 0)
+        value = part;
+    else if (dots == 3 && part <= 255)
+        value = (value << 8) | part;
+    else
+        return 0;
+    *ip = (int32_t)value;
+    return 1;
+}
+
+int zone_next(struct zone_file *zone, const char **name, size_t *length,
+              int32_t *ip4_address)
+{
+    const char *end = zone->base + zone->size;
+
+    while (zone->cursor < end)
+    {
+        const char *line = zone->cursor, *eol, *p, *name_end, *ip_start, *ip_end;
+
+        eol = memchr(line, '\n', end - line);
+        if (!eol)
+            eol = end;
+        zone->cursor = eol < end ? eol + 1 : end;
+        zone->lines++;
+
+        // name: first field
+        for (p = line; p < eol && is_blank(*p); ++p)
+            ;
+        if (p == eol || *p == '#' || *p == ';')
+            continue;
+        *name = p;
+        while (p < eol && !is_blank(*p))
+            ++p;
+        name_end = p;
+
+        // ip: second field, anything after it is ignored
+        while (p < eol && is_blank(*p))
+            ++p;
+        ip_start = p;
+        while (p < eol && !is_blank(*p))
+            ++p;
+        ip_end = p;
+
+        if (name_end > *name + 1 && name_end[-1] == '.')
+            --name_end;
+        if (ip_start == ip_end || !parse_ip(ip_start, ip_end, ip4_address))
+        {
+            zone->malformed++;
+            continue;
+        }
+        *length = name_end - *name;
+        return 1;
+    }
+    return 0;
+}
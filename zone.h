@@ -0,0 +1,35 @@
+#ifndef __ZONE_H__
+#define __ZONE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Zone (seed) files used to pre-populate the trie at startup.
+ *
+ * The format is one record per line, "name ip", where ip is either a
+ * dotted quad or a decimal integer.  Blank lines and lines starting
+ * with '#' or ';' are ignored, and a trailing '.' on a fully
+ * qualified name is dropped.  The file is memory-mapped and parsed in
+ * place: names are returned as pointers into the mapping, so loading
+ * makes no per-line allocations.
+ */
+
+struct zone_file {
+    const char *base;
+    size_t size;
+    const char *cursor;     /* next unparsed byte */
+    uint64_t lines;         /* lines consumed so far */
+    uint64_t malformed;     /* non-blank, non-comment lines skipped */
+};
+
+/* Map a zone file.  Returns 0 and prints a message on failure. */
+int zone_open(struct zone_file *zone, const char *path);
+void zone_close(struct zone_file *zone);
+
+/* Parse the next record.  name is not NUL-terminated and stays valid
+ * until zone_close().  Returns 0 at end of file.
+ */
+int zone_next(struct zone_file *zone, const char **name, size_t *length,
+              int32_t *ip4_address);
+
+#endif /* __ZONE_H__ */